@@ -10,6 +10,13 @@ fn main() {
 
     cmd.arg(format!("DESTDIR={}/", destdir));
 
+    // Objects are made in src/, and may be left from a build with other flags
+    cmd.arg("-B");
+    let openmp = getenv("CARGO_FEATURE_OPENMP").is_ok();
+    if openmp {
+        cmd.arg("OPENMP=1");
+    }
+
     if let Some(j) = getenv("NUM_JOBS").ok() {
         cmd.arg(format!("-j{}", j));
     }
@@ -21,6 +28,9 @@ fn main() {
     }
 
     println!("cargo:rustc-flags=-L {} {} -l static=dssim", destdir, getframework());
+    if openmp {
+        println!("cargo:rustc-link-lib={}", getopenmp());
+    }
     println!("cargo:root={}", destdir);
 }
 
@@ -33,3 +43,13 @@ fn getframework() -> &'static str {
 fn getframework() -> &'static str {
     ""
 }
+
+#[cfg(target_os = "macos")]
+fn getopenmp() -> &'static str {
+    "omp"
+}
+
+#[cfg(not(target_os = "macos"))]
+fn getopenmp() -> &'static str {
+    "gomp"
+}
@@ -18,15 +18,39 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 #include "dssim.h"
 
 #ifdef USE_COCOA
 #import <Accelerate/Accelerate.h>
 #endif
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DSSIM_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define DSSIM_X86_SIMD 0
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#define omp_get_num_threads() 1
+#define omp_get_thread_num() 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 #ifndef MIN
 #define MIN(a,b) ((a)<=(b)?(a):(b))
 #endif
@@ -49,12 +73,29 @@ typedef struct {
     dssim_px_t r, g, b, a; // premultiplied
 } linear_rgba;
 
+/* Blur used by SSIM (see dssim_set_blur_sigma) */
+typedef struct {
+    double sigma; // 0 for the default box blurs
+    dssim_px_t gaussian_coeffs[4];
+} blur_window;
+
 struct dssim_chan;
 typedef struct dssim_chan dssim_chan;
 struct dssim_chan {
     int width, height;
     dssim_px_t *img, *mu, *img_sq_blur;
+    // Distance between rows of img in pixels. It's width, unless img is the caller's (see dssim_create_image_float_planes).
+    size_t stride;
+    bool img_borrowed; // img is the caller's, and is never written or freed
+    // Used instead of img, mu and img_sq_blur by the fixed-point path (see dssim_set_fixed_point)
+    unsigned char *img_u8;
+    uint16_t *mu_u16;
+    uint32_t *img_sq_blur_u32;
+    // Used instead of img, mu and img_sq_blur after preprocessing with half storage (see dssim_set_half_storage)
+    uint16_t *img_f16, *mu_f16, *sigma_sq_f16;
     bool is_chroma;
+    bool half_storage; // setting of the attr when the image was created, used when the channel is preprocessed
+    blur_window blur; // likewise
 };
 
 typedef struct dssim_image_chan {
@@ -65,6 +106,10 @@ typedef struct dssim_image_chan {
 struct dssim_image {
     dssim_image_chan chan[MAX_CHANS];
     int num_channels;
+    // R==G==B image stored as luma only. Its chroma is constant, so chan[1] and chan[2] only have sizes of scales.
+    bool is_gray;
+    // Held while a comparison blurs scales of the image as the original, which may be shared by comparisons in other threads
+    pthread_mutex_t blur_lock;
 };
 
 struct dssim_ssim_map_chan {
@@ -80,12 +125,25 @@ struct dssim_attr {
     bool subsample_chroma;
     int save_maps_scales, save_maps_channels;
     struct dssim_ssim_map_chan ssim_maps[MAX_CHANS];
+    blur_window blur;
+    bool fixed_point;
+    int num_threads;
+    bool half_storage;
+    bool color_lut;
+    struct dssim_lab_lut *lab_lut;
 };
 
+static void dssim_init_kernels(void);
+
+/* Kernels are global, and picked once, because attrs may be created while other threads use them */
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
 /* Scales are taken from IW-SSIM, but this is not IW-SSIM algorithm */
 static const double default_weights[] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
 
 dssim_attr *dssim_create_attr(void) {
+    pthread_once(&kernels_once, dssim_init_kernels);
+
     dssim_attr *attr = malloc(sizeof(attr[0]));
     *attr = (dssim_attr){
         /* Bigger number puts more emphasis on color channels. */
@@ -105,6 +163,7 @@ void dssim_dealloc_attr(dssim_attr *attr) {
         }
     }
     free(attr->tmp);
+    free(attr->lab_lut);
     free(attr);
 }
 
@@ -124,6 +183,80 @@ void dssim_set_color_handling(dssim_attr *attr, int subsample_chroma, double col
     attr->color_weight = color_weight;
 }
 
+/*
+ * Coefficients of the recursive Gaussian from "Recursive implementation of the Gaussian filter"
+ * by Young and van Vliet (1995), normalized so that c[0] is the weight of the input and c[1..3] of previous outputs.
+ */
+static void gaussian_coeffs(const double q, double c[static 4])
+{
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q*q + 0.422205 * q*q*q;
+    const double b1 = 2.44413 * q + 2.85619 * q*q + 1.26661 * q*q*q;
+    const double b2 = -(1.4281 * q*q + 1.26661 * q*q*q);
+    const double b3 = 0.422205 * q*q*q;
+
+    c[0] = 1.0 - (b1 + b2 + b3) / b0;
+    c[1] = b1 / b0;
+    c[2] = b2 / b0;
+    c[3] = b3 / b0;
+}
+
+/*
+ * Variance of the impulse response of the causal and anti-causal passes together
+ */
+static double gaussian_variance(const double q)
+{
+    double c[4];
+    gaussian_coeffs(q, c);
+    const double m1 = c[1] + 2.0 * c[2] + 3.0 * c[3];
+    const double m2 = 2.0 * c[2] + 6.0 * c[3];
+    return 2.0 * (m1 * m1 / (c[0] * c[0]) + (m2 + m1) / c[0]);
+}
+
+void dssim_set_blur_sigma(dssim_attr *attr, double sigma) {
+    if (!(sigma >= 0.5)) {
+        attr->blur = (blur_window){0};
+        return;
+    }
+    attr->blur.sigma = sigma;
+
+    // The paper's closed-form q gives a response about 10% wider than sigma, so q is solved for the exact variance instead
+    double lo = 0, hi = 2.0 * sigma + 2.0;
+    for(int i=0; i < 50; i++) {
+        const double mid = (lo + hi) / 2.0;
+        if (gaussian_variance(mid) < sigma * sigma) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    double c[4];
+    gaussian_coeffs((lo + hi) / 2.0, c);
+    for(int i=0; i < 4; i++) {
+        attr->blur.gaussian_coeffs[i] = c[i];
+    }
+}
+
+void dssim_set_fixed_point(dssim_attr *attr, int enabled) {
+    attr->fixed_point = enabled;
+}
+
+void dssim_set_half_storage(dssim_attr *attr, int enabled) {
+    attr->half_storage = enabled;
+}
+
+void dssim_set_color_lut(dssim_attr *attr, int enabled) {
+    attr->color_lut = enabled;
+}
+
+void dssim_set_threads(dssim_attr *attr, int num_threads) {
+    attr->num_threads = MAX(0, num_threads);
+}
+
+static int dssim_num_threads(const dssim_attr *attr) {
+    return attr->num_threads ? attr->num_threads : omp_get_max_threads();
+}
+
 void dssim_set_save_ssim_maps(dssim_attr *attr, unsigned int scales, unsigned int channels) {
     attr->save_maps_scales = scales;
     attr->save_maps_channels = channels;
@@ -150,10 +283,25 @@ static dssim_px_t *dssim_get_tmp(dssim_attr *attr, size_t size) {
     return attr->tmp;
 }
 
+/* Frees img, unless it's the caller's */
+static void release_img(dssim_chan *chan) {
+    if (!chan->img_borrowed) {
+        free(chan->img);
+    }
+    chan->img = NULL;
+    chan->img_borrowed = false;
+}
+
 static void dealloc_chan(dssim_chan *chan) {
-    free(chan->img);
+    release_img(chan);
     free(chan->mu);
     free(chan->img_sq_blur);
+    free(chan->img_u8);
+    free(chan->mu_u16);
+    free(chan->img_sq_blur_u32);
+    free(chan->img_f16);
+    free(chan->mu_f16);
+    free(chan->sigma_sq_f16);
 }
 
 void dssim_dealloc_image(dssim_image *img)
@@ -163,24 +311,35 @@ void dssim_dealloc_image(dssim_image *img)
             dealloc_chan(&img->chan[ch].scales[s]);
         }
     }
+    pthread_mutex_destroy(&img->blur_lock);
     free(img);
 }
 
-static int set_gamma(dssim_px_t gamma_lut[static 256], const double invgamma)
+/*
+ * Linear value of gamma-encoded s in [0,1]. invgamma must have been checked by set_gamma().
+ */
+static double gamma_to_linear(const double s, const double invgamma)
 {
     if (invgamma == dssim_srgb_gamma) {
-        for (int i = 0; i < 256; i++) {
-            const double s = i / 255.0;
-            if (s <= 0.04045) {
-                gamma_lut[i] = s / 12.92;
-            } else {
-                gamma_lut[i] = pow((s + 0.055) / 1.055, 2.4);
-            }
+        if (s <= 0.04045) {
+            return s / 12.92;
+        } else {
+            return pow((s + 0.055) / 1.055, 2.4);
         }
-        return 1;
-    } else if (invgamma > 0 && invgamma < 1.0) {
+    }
+    return pow(s, 1.0 / invgamma);
+}
+
+static bool valid_gamma(const double invgamma)
+{
+    return invgamma == dssim_srgb_gamma || (invgamma > 0 && invgamma < 1.0);
+}
+
+static int set_gamma(dssim_px_t gamma_lut[static 256], const double invgamma)
+{
+    if (valid_gamma(invgamma)) {
         for (int i = 0; i < 256; i++) {
-            gamma_lut[i] = pow(i / 255.0, 1.0 / invgamma);
+            gamma_lut[i] = gamma_to_linear(i / 255.0, invgamma);
         }
         return 1;
     } else {
@@ -223,445 +382,2289 @@ inline static dssim_lab rgb_to_lab(const dssim_px_t r, const dssim_px_t g, const
     };
 }
 
-#ifndef USE_COCOA
 /*
- * Flips x/y (like 90deg rotation)
+ * rgb_to_lab() of n pixels of planar linear RGB. A and b may be NULL if only L is needed.
  */
-static void transpose(dssim_px_t *restrict src, dssim_px_t *restrict dst, const int width, const int height)
+static void linear_to_lab_scalar(const dssim_px_t *restrict r, const dssim_px_t *restrict g, const dssim_px_t *restrict b, dssim_px_t *restrict l, dssim_px_t *restrict A, dssim_px_t *restrict B, const int n)
 {
-    int j = 0;
-    for (; j < height-4; j+=4) {
-        dssim_px_t *restrict row0 = src + (j+0) * width;
-        dssim_px_t *restrict row1 = src + (j+1) * width;
-        dssim_px_t *restrict row2 = src + (j+2) * width;
-        dssim_px_t *restrict row3 = src + (j+3) * width;
-        for(int i=0; i < width; i++) {
-            dst[i*height + j+0] = row0[i];
-            dst[i*height + j+1] = row1[i];
-            dst[i*height + j+2] = row2[i];
-            dst[i*height + j+3] = row3[i];
+    for(int i=0; i < n; i++) {
+        const dssim_lab px = rgb_to_lab(r[i], g[i], b[i]);
+        l[i] = px.l;
+        if (A) {
+            A[i] = px.A;
+            B[i] = px.b;
         }
     }
+}
+
+#if DSSIM_X86_SIMD
+/*
+ * Cube root of positive x. The seed divides the exponent by dividing the bits of x by 3 (within 4%),
+ * one Halley iteration brings it within about 1e-4, and a Newton correction to float precision.
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 cbrt_avx2(const __m256 x)
+{
+    const __m256 bits_div3 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(x)), _mm256_set1_ps(1.f/3.f));
+    __m256 y = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_cvtps_epi32(bits_div3), _mm256_set1_epi32(709921077)));
+
+    const __m256 y3 = _mm256_mul_ps(_mm256_mul_ps(y, y), y);
+    y = _mm256_mul_ps(y, _mm256_div_ps(_mm256_add_ps(y3, _mm256_add_ps(x, x)), _mm256_fmadd_ps(y3, _mm256_set1_ps(2.f), x)));
+
+    const __m256 y2 = _mm256_mul_ps(y, y);
+    const __m256 residual = _mm256_fmsub_ps(y2, y, x);
+    return _mm256_sub_ps(y, _mm256_div_ps(residual, _mm256_mul_ps(y2, _mm256_set1_ps(3.f))));
+}
+
+/*
+ * The nonlinear part of rgb_to_lab() for one component
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 lab_f_avx2(const __m256 f)
+{
+    const __m256 epsilon = _mm256_set1_ps(216.0 / 24389.0);
+    const __m256 k = _mm256_set1_ps((24389.0 / 27.0) / 116.0);
+    const __m256 root = _mm256_sub_ps(cbrt_avx2(f), _mm256_set1_ps(16.f/116.f));
+    return _mm256_blendv_ps(_mm256_mul_ps(f, k), root, _mm256_cmp_ps(f, epsilon, _CMP_GT_OQ));
+}
 
-    for (; j < height; j++) {
-        dssim_px_t *restrict row = src + j * width;
-        for(int i=0; i < width; i++) {
-            dst[i*height + j] = row[i];
+/*
+ * AVX2 version of linear_to_lab_scalar(), with the matrix applied in float. L, A and b are within 3e-7 of exact values (see src/dssim_test.c),
+ * which is closer than rgb_to_lab() gets with powf(x, 1.f/3.f), and differ from rgb_to_lab() by less than 1e-6.
+ */
+__attribute__((target("avx2,fma")))
+static void linear_to_lab_avx2(const dssim_px_t *restrict r, const dssim_px_t *restrict g, const dssim_px_t *restrict b, dssim_px_t *restrict l, dssim_px_t *restrict A, dssim_px_t *restrict B, const int n)
+{
+    int i=0;
+    for(; i+8 <= n; i+=8) {
+        const __m256 vr = _mm256_loadu_ps(r + i);
+        const __m256 vg = _mm256_loadu_ps(g + i);
+        const __m256 vb = _mm256_loadu_ps(b + i);
+
+        const __m256 fx = _mm256_fmadd_ps(vr, _mm256_set1_ps(0.4124 / D65x), _mm256_fmadd_ps(vg, _mm256_set1_ps(0.3576 / D65x), _mm256_mul_ps(vb, _mm256_set1_ps(0.1805 / D65x))));
+        const __m256 fy = _mm256_fmadd_ps(vr, _mm256_set1_ps(0.2126 / D65y), _mm256_fmadd_ps(vg, _mm256_set1_ps(0.7152 / D65y), _mm256_mul_ps(vb, _mm256_set1_ps(0.0722 / D65y))));
+        const __m256 fz = _mm256_fmadd_ps(vr, _mm256_set1_ps(0.0193 / D65z), _mm256_fmadd_ps(vg, _mm256_set1_ps(0.1192 / D65z), _mm256_mul_ps(vb, _mm256_set1_ps(0.9505 / D65z))));
+
+        const __m256 Y = lab_f_avx2(fy);
+        _mm256_storeu_ps(l + i, _mm256_mul_ps(Y, _mm256_set1_ps(1.16f)));
+        if (A) {
+            const __m256 X = lab_f_avx2(fx);
+            const __m256 Z = lab_f_avx2(fz);
+            _mm256_storeu_ps(A + i, _mm256_fmadd_ps(_mm256_sub_ps(X, Y), _mm256_set1_ps(500.0f/ 220.0f), _mm256_set1_ps(86.2f/ 220.0f)));
+            _mm256_storeu_ps(B + i, _mm256_fmadd_ps(_mm256_sub_ps(Y, Z), _mm256_set1_ps(200.0f/ 220.0f), _mm256_set1_ps(107.9f/ 220.0f)));
         }
     }
+
+    linear_to_lab_scalar(r + i, g + i, b + i, l + i, A ? A + i : NULL, A ? B + i : NULL, n - i);
 }
 
-static void regular_1d_blur(const dssim_px_t *src, dssim_px_t *restrict tmp1, dssim_px_t *dst, const int width, const int height)
-{
-    const int runs = 2;
-    assert(src);
-    assert(tmp1);
-    assert(dst);
-    assert(width > 4);
-    assert(height > 4);
+#endif
 
-    // tmp1 is expected to hold at least two lines
-    dssim_px_t *restrict tmp2 = tmp1 + width;
+typedef void linear_to_lab_fn(const dssim_px_t *restrict r, const dssim_px_t *restrict g, const dssim_px_t *restrict b, dssim_px_t *restrict l, dssim_px_t *restrict A, dssim_px_t *restrict B, const int n);
 
-    for(int j=0; j < height; j++) {
-        for(int run = 0; run < runs; run++) {
-            // To improve locality blur is done on tmp1->tmp2 and tmp2->tmp1 buffers,
-            // except first and last run which use src->tmp and tmp->dst
-            const dssim_px_t *restrict row = (run == 0   ? src + j*width : (run & 1) ? tmp1 : tmp2);
-            dssim_px_t *restrict dstrow = (run == runs-1 ? dst + j*width : (run & 1) ? tmp2 : tmp1);
+static linear_to_lab_fn *linear_to_lab = linear_to_lab_scalar;
 
-            int i=0;
-            for(; i < MIN(4, width); i++) {
-                dstrow[i] = (row[MAX(0, i-1)] + row[i] + row[MIN(width-1, i+1)]) / 3.f;
-            }
+/* The table of dssim_set_color_lut() is slower than linear_to_lab_avx2(), so it's not used when that's picked */
+static bool lab_lut_is_faster = true;
 
-            const int end = (width-1) & ~3UL;
-            for(; i < end; i+=4) {
-                const dssim_px_t p1 = row[i-1];
-                const dssim_px_t n0 = row[i+0];
-                const dssim_px_t n1 = row[i+1];
-                const dssim_px_t n2 = row[i+2];
-                const dssim_px_t n3 = row[i+3];
-                const dssim_px_t n4 = row[i+4];
-
-                dstrow[i+0] = (p1 + n0 + n1) / 3.f;
-                dstrow[i+1] = (n0 + n1 + n2) / 3.f;
-                dstrow[i+2] = (n1 + n2 + n3) / 3.f;
-                dstrow[i+3] = (n2 + n3 + n4) / 3.f;
-            }
+/* Grid points per axis of the table used with dssim_set_color_lut(). 255 is not a multiple of 32, so the grid doesn't hit 8-bit values exactly. */
+#define LAB_LUT_SIZE 33
+
+/*
+ * rgb_to_lab() of gamma-encoded 8-bit RGB, sampled on a LAB_LUT_SIZE^3 grid of encoded values
+ */
+typedef struct dssim_lab_lut {
+    double gamma;
+    int index[256]; // grid cell of each 8-bit value
+    dssim_px_t frac[256]; // position within the cell
+    dssim_lab grid[LAB_LUT_SIZE * LAB_LUT_SIZE * LAB_LUT_SIZE];
+} dssim_lab_lut;
+
+static dssim_lab_lut *lab_lut_create(const double gamma)
+{
+    dssim_lab_lut *lut = malloc(sizeof(lut[0]));
+    lut->gamma = gamma;
 
-            for(; i < width; i++) {
-                dstrow[i] = (row[MAX(0, i-1)] + row[i] + row[MIN(width-1, i+1)]) / 3.f;
+    for(int i=0; i < 256; i++) {
+        const double pos = i * (LAB_LUT_SIZE - 1) / 255.0;
+        lut->index[i] = MIN(LAB_LUT_SIZE - 2, (int)pos);
+        lut->frac[i] = pos - lut->index[i];
+    }
+
+    dssim_px_t linear[LAB_LUT_SIZE];
+    for(int i=0; i < LAB_LUT_SIZE; i++) {
+        linear[i] = gamma_to_linear(i / (double)(LAB_LUT_SIZE - 1), gamma);
+    }
+
+    dssim_px_t r[LAB_LUT_SIZE], g[LAB_LUT_SIZE], l[LAB_LUT_SIZE], A[LAB_LUT_SIZE], B[LAB_LUT_SIZE];
+    dssim_lab *px = lut->grid;
+    for(int ri=0; ri < LAB_LUT_SIZE; ri++) {
+        for(int gi=0; gi < LAB_LUT_SIZE; gi++) {
+            for(int bi=0; bi < LAB_LUT_SIZE; bi++) {
+                r[bi] = linear[ri];
+                g[bi] = linear[gi];
+            }
+            linear_to_lab(r, g, linear, l, A, B, LAB_LUT_SIZE);
+            for(int bi=0; bi < LAB_LUT_SIZE; bi++) {
+                *px++ = (dssim_lab){l[bi], A[bi], B[bi]};
             }
         }
     }
+    return lut;
 }
-#endif
 
 /*
- * blurs (approximate of gaussian)
+ * The table is built on first use and rebuilt only when images with a different gamma are created
  */
-static void blur(const dssim_px_t *restrict src, dssim_px_t *restrict tmp, dssim_px_t *restrict dst,
-                 const int width, const int height)
+static const dssim_lab_lut *dssim_get_lab_lut(dssim_attr *attr, const double gamma)
 {
-    assert(src);
-    assert(dst);
-    assert(tmp);
-#ifdef USE_COCOA
-    vImage_Buffer srcbuf = {
-        .width = width,
-        .height = height,
-        .rowBytes = width * sizeof(dssim_px_t),
-        .data = (void*)src,
-    };
-    vImage_Buffer dstbuf = {
-        .width = width,
-        .height = height,
-        .rowBytes = width * sizeof(dssim_px_t),
-        .data = dst,
-    };
-    vImage_Buffer tmpbuf = {
-        .width = width,
-        .height = height,
-        .rowBytes = width * sizeof(dssim_px_t),
-        .data = tmp,
-    };
+    if (!attr->lab_lut || attr->lab_lut->gamma != gamma) {
+        free(attr->lab_lut);
+        attr->lab_lut = lab_lut_create(gamma);
+    }
+    return attr->lab_lut;
+}
 
-    dssim_px_t kernel[9] = {
-        1/16.f, 1/8.f, 1/16.f,
-        1/8.f,  1/4.f, 1/8.f,
-        1/16.f, 1/8.f, 1/16.f,
+/*
+ * Tetrahedral interpolation: the cell is split along its black-white diagonal into 6 tetrahedra, and the order
+ * of the fractions picks the one containing the pixel.
+ */
+inline static dssim_lab lab_lut_lookup(const dssim_lab_lut *lut, const unsigned char r, const unsigned char g, const unsigned char b)
+{
+    const int dr = LAB_LUT_SIZE * LAB_LUT_SIZE, dg = LAB_LUT_SIZE, db = 1;
+    const dssim_lab *const c000 = &lut->grid[lut->index[r] * dr + lut->index[g] * dg + lut->index[b]];
+    const dssim_px_t fr = lut->frac[r], fg = lut->frac[g], fb = lut->frac[b];
+
+    const dssim_px_t hi = MAX(fr, MAX(fg, fb)), lo = MIN(fr, MIN(fg, fb)), mid = fr + fg + fb - hi - lo;
+    // On ties the axes are picked in opposite orders, so that they differ unless all fractions are equal.
+    // Flags are multiplied rather than branched on, because neighbouring pixels rarely share the tetrahedron.
+    const int r_hi = fr == hi, g_hi = !r_hi & (fg == hi);
+    const int b_lo = fb == lo, g_lo = !b_lo & (fg == lo);
+    const int hi_axis = db + r_hi * (dr - db) + g_hi * (dg - db);
+    const int lo_axis = dr + b_lo * (db - dr) + g_lo * (dg - dr);
+    const dssim_lab *const c1 = c000 + hi_axis;
+    const dssim_lab *const c2 = c000 + dr + dg + db - lo_axis;
+    const dssim_lab *const c111 = c000 + dr + dg + db;
+
+    const dssim_px_t w0 = 1.f - hi, w1 = hi - mid, w2 = mid - lo, w3 = lo;
+    return (dssim_lab){
+        w0 * c000->l + w1 * c1->l + w2 * c2->l + w3 * c111->l,
+        w0 * c000->A + w1 * c1->A + w2 * c2->A + w3 * c111->A,
+        w0 * c000->b + w1 * c1->b + w2 * c2->b + w3 * c111->b,
     };
-
-    vImageConvolve_PlanarF(&srcbuf, &tmpbuf, NULL, 0, 0, kernel, 3, 3, 0, kvImageEdgeExtend);
-    vImageConvolve_PlanarF(&tmpbuf, &dstbuf, NULL, 0, 0, kernel, 3, 3, 0, kvImageEdgeExtend);
-#else
-    regular_1d_blur(src, tmp, dst, width, height);
-    transpose(dst, tmp, width, height);
-
-    // After transposing buffer is rotated, so height and width are swapped
-    // And reuse of buffers made tmp hold the image, and dst used as temporary until the last transpose
-    regular_1d_blur(tmp, dst, tmp, height, width);
-    transpose(tmp, dst, height, width);
-#endif
 }
 
+#ifndef USE_COCOA
 /*
- * Conversion is not reversible
+ * 3-tap box blur of a single row. Edge pixels are repeated.
  */
-inline static dssim_lab convert_pixel_rgba(linear_rgba px, int i, int j)
+static void blur_row_scalar(const dssim_px_t *restrict row, dssim_px_t *restrict dstrow, const int width)
 {
-    // Compose image on coloured background to better judge dissimilarity with various backgrounds
-    if (px.a < 255) {
-        int n = i ^ j;
-        if (n & 4) {
-            px.r += 1.0 - px.a; // assumes premultiplied alpha
-        }
-        if (n & 8) {
-            px.g += 1.0 - px.a;
-        }
-        if (n & 16) {
-            px.b += 1.0 - px.a;
-        }
+    int i=0;
+    for(; i < MIN(4, width); i++) {
+        dstrow[i] = (row[MAX(0, i-1)] + row[i] + row[MIN(width-1, i+1)]) / 3.f;
     }
 
-    dssim_lab f1 = rgb_to_lab(px.r, px.g, px.b);
-    assert(f1.l >= 0.f && f1.l <= 1.0f);
-    assert(f1.A >= 0.f && f1.A <= 1.0f);
-    assert(f1.b >= 0.f && f1.b <= 1.0f);
+    const int end = (width-1) & ~3UL;
+    for(; i < end; i+=4) {
+        const dssim_px_t p1 = row[i-1];
+        const dssim_px_t n0 = row[i+0];
+        const dssim_px_t n1 = row[i+1];
+        const dssim_px_t n2 = row[i+2];
+        const dssim_px_t n3 = row[i+3];
+        const dssim_px_t n4 = row[i+4];
+
+        dstrow[i+0] = (p1 + n0 + n1) / 3.f;
+        dstrow[i+1] = (n0 + n1 + n2) / 3.f;
+        dstrow[i+2] = (n1 + n2 + n3) / 3.f;
+        dstrow[i+3] = (n2 + n3 + n4) / 3.f;
+    }
 
-    return f1;
+    for(; i < width; i++) {
+        dstrow[i] = (row[MAX(0, i-1)] + row[i] + row[MIN(width-1, i+1)]) / 3.f;
+    }
 }
 
-/* copy number of rows from a 2x larger image */
-static void subsampled_copy(dssim_chan *new_chan, const int dest_y_offset, const int rows, const dssim_px_t *src_img, const int src_width)
+/*
+ * Averages 3 rows, which is one step of the vertical box blur
+ */
+static void blur_rows3_scalar(const dssim_px_t *prev, const dssim_px_t *curr, const dssim_px_t *next, dssim_px_t *restrict dstrow, const int width)
 {
-    for(int y = 0; y < rows; y++) {
-        for(int x = 0; x < new_chan->width; x++) {
-            new_chan->img[x + (y + dest_y_offset) * new_chan->width] = 0.25 * (
-                src_img[x*2 + y*2 * src_width] + src_img[x*2+1 + y*2 * src_width] +
-                src_img[x*2 + (y*2+1) * src_width] + src_img[x*2+1 + (y*2+1) * src_width]
-            );
-        }
+    for(int i=0; i < width; i++) {
+        dstrow[i] = (prev[i] + curr[i] + next[i]) / 3.f;
     }
 }
 
-static void convert_image_subsampled(dssim_image *img, dssim_row_callback cb, void *callback_user_data)
+#if DSSIM_X86_SIMD
+/*
+ * SIMD versions of blur_row_scalar() and blur_rows3_scalar(). They divide by multiplying by 1/3, and -ffast-math lets the compiler
+ * regroup the scalar sums, so output may differ from the scalar path by up to 3 ulp per pixel
+ * (relative error below 4e-7). This moves DSSIM scores only in the 7th significant digit.
+ */
+__attribute__((target("sse4.1")))
+static void blur_row_sse41(const dssim_px_t *restrict row, dssim_px_t *restrict dstrow, const int width)
 {
-    dssim_chan *chan = &img->chan[0].scales[0];
-    const int width = chan->width;
-    const int height = chan->height;
-    dssim_px_t *row_tmp0[img->num_channels];
-    dssim_px_t *row_tmp1[img->num_channels];
+    const __m128 third = _mm_set1_ps(1.f/3.f);
+
+    dstrow[0] = (row[0] + row[0] + row[MIN(width-1, 1)]) * (1.f/3.f);
 
-    for(int ch = 1; ch < img->num_channels; ch++) {
-        row_tmp0[ch] = calloc(width*2, sizeof(row_tmp0[0])); // for the callback all channels have the same width!
-        row_tmp1[ch] = row_tmp0[ch] + width;
+    int i=1;
+    for(; i+4 < width; i+=4) {
+        const __m128 prev = _mm_loadu_ps(row + i-1);
+        const __m128 curr = _mm_loadu_ps(row + i);
+        const __m128 next = _mm_loadu_ps(row + i+1);
+        _mm_storeu_ps(dstrow + i, _mm_mul_ps(_mm_add_ps(_mm_add_ps(prev, curr), next), third));
     }
 
-    for(int y = 0; y < height; y += 2) {
-        row_tmp0[0] = &chan->img[width * y]; // Luma can be written directly (it's unscaled)
-        row_tmp1[0] = &chan->img[width * MIN(height-1, y+1)];
+    for(; i < width; i++) {
+        dstrow[i] = (row[i-1] + row[i] + row[MIN(width-1, i+1)]) * (1.f/3.f);
+    }
+}
+
+__attribute__((target("avx2")))
+static void blur_row_avx2(const dssim_px_t *restrict row, dssim_px_t *restrict dstrow, const int width)
+{
+    const __m256 third = _mm256_set1_ps(1.f/3.f);
 
-        cb(row_tmp0, img->num_channels, y, width, callback_user_data);
-        cb(row_tmp1, img->num_channels, MIN(height-1, y+1), width, callback_user_data);
+    dstrow[0] = (row[0] + row[0] + row[MIN(width-1, 1)]) * (1.f/3.f);
 
-        if (y < height-1) {
-            for(int ch = 1; ch < img->num_channels; ch++) { // Chroma is downsampled
-                subsampled_copy(&img->chan[ch].scales[0], y/2, 1, row_tmp0[ch], width);
-            }
-        }
+    int i=1;
+    for(; i+8 < width; i+=8) {
+        const __m256 prev = _mm256_loadu_ps(row + i-1);
+        const __m256 curr = _mm256_loadu_ps(row + i);
+        const __m256 next = _mm256_loadu_ps(row + i+1);
+        _mm256_storeu_ps(dstrow + i, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(prev, curr), next), third));
     }
 
-    for(int ch = 1; ch < img->num_channels; ch++) {
-        free(row_tmp0[ch]);
+    for(; i < width; i++) {
+        dstrow[i] = (row[i-1] + row[i] + row[MIN(width-1, i+1)]) * (1.f/3.f);
     }
 }
 
-static void convert_image_simple(dssim_image *img, dssim_row_callback cb, void *callback_user_data)
+__attribute__((target("sse4.1")))
+static void blur_rows3_sse41(const dssim_px_t *prev, const dssim_px_t *curr, const dssim_px_t *next, dssim_px_t *restrict dstrow, const int width)
 {
-    dssim_chan *chan = &img->chan[0].scales[0];
-    const int width = chan->width;
-    const int height = chan->height;
-    dssim_px_t *row_tmp[img->num_channels];
+    const __m128 third = _mm_set1_ps(1.f/3.f);
 
-    for(int y = 0; y < height; y++) {
-        for(int ch = 0; ch < img->num_channels; ch++) {
-            row_tmp[ch] = &img->chan[ch].scales[0].img[width * y];
-        }
-        cb(row_tmp, img->num_channels, y, width, callback_user_data);
+    int i=0;
+    for(; i+4 <= width; i+=4) {
+        const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(prev + i), _mm_loadu_ps(curr + i)), _mm_loadu_ps(next + i));
+        _mm_storeu_ps(dstrow + i, _mm_mul_ps(sum, third));
     }
-}
 
-typedef struct {
-    dssim_px_t gamma_lut[256];
-    const unsigned char *const *const row_pointers;
-} image_data;
+    for(; i < width; i++) {
+        dstrow[i] = (prev[i] + curr[i] + next[i]) * (1.f/3.f);
+    }
+}
 
-static void convert_image_row_rgba(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int width, void *user_data)
+__attribute__((target("avx2")))
+static void blur_rows3_avx2(const dssim_px_t *prev, const dssim_px_t *curr, const dssim_px_t *next, dssim_px_t *restrict dstrow, const int width)
 {
-    image_data *im = (image_data*)user_data;
-    const dssim_rgba *const row = (dssim_rgba *)im->row_pointers[y];
-    const dssim_px_t *const gamma_lut = im->gamma_lut;
+    const __m256 third = _mm256_set1_ps(1.f/3.f);
 
-    for (int x = 0; x < width; x++) {
-        const linear_rgba rgba = rgb_to_linear(gamma_lut, row[x].r, row[x].g, row[x].b, row[x].a);
-        const dssim_lab px = convert_pixel_rgba(rgba, x, y);
-        channels[0][x] = px.l;
-        if (num_channels >= 3) {
-            channels[1][x] = px.A;
-            channels[2][x] = px.b;
-        }
+    int i=0;
+    for(; i+8 <= width; i+=8) {
+        const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(prev + i), _mm256_loadu_ps(curr + i)), _mm256_loadu_ps(next + i));
+        _mm256_storeu_ps(dstrow + i, _mm256_mul_ps(sum, third));
+    }
+
+    for(; i < width; i++) {
+        dstrow[i] = (prev[i] + curr[i] + next[i]) * (1.f/3.f);
     }
 }
+#endif
 
-static void convert_image_row_rgb(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int width, void *user_data)
-{
-    image_data *im = (image_data*)user_data;
-    const dssim_rgb *const row = (dssim_rgb *)im->row_pointers[y];
-    const dssim_px_t *const gamma_lut = im->gamma_lut;
+typedef void blur_row_fn(const dssim_px_t *restrict row, dssim_px_t *restrict dstrow, const int width);
+typedef void blur_rows3_fn(const dssim_px_t *prev, const dssim_px_t *curr, const dssim_px_t *next, dssim_px_t *restrict dstrow, const int width);
 
-    for (int x = 0; x < width; x++) {
-        dssim_lab px = rgb_to_lab(gamma_lut[row[x].r], gamma_lut[row[x].g], gamma_lut[row[x].b]);
-        channels[0][x] = px.l;
-        if (num_channels >= 3) {
-            channels[1][x] = px.A;
-            channels[2][x] = px.b;
-        }
-    }
+/* Best implementations for the current CPU, see dssim_init_kernels() */
+static blur_row_fn *blur_row = blur_row_scalar;
+static blur_rows3_fn *blur_rows3 = blur_rows3_scalar;
+
+/*
+ * Horizontal blur of one row (two box passes)
+ */
+static void blur_row_twice(const dssim_px_t *restrict row, dssim_px_t *restrict row_tmp, dssim_px_t *restrict dstrow, const int width)
+{
+    blur_row(row, row_tmp, width);
+    blur_row(row_tmp, dstrow, width);
 }
+#endif
 
-static void convert_image_row_gray_init(dssim_px_t gamma_lut[static 256]) {
-    for(int i=0; i < 256; i++) {
-        gamma_lut[i] = rgb_to_lab(gamma_lut[i], gamma_lut[i], gamma_lut[i]).l;
+/*
+ * Averages 2x2 blocks of two rows into n pixels.
+ * It's never inlined, because -ffast-math could regroup the sums differently when it's compiled into the tails of the SIMD versions.
+ */
+__attribute__((noinline))
+static void downsample_rows_scalar(const dssim_px_t *row0, const dssim_px_t *row1, dssim_px_t *restrict dstrow, const int n)
+{
+    for(int x=0; x < n; x++) {
+        dstrow[x] = 0.25f * (row0[2*x] + row0[2*x+1] + row1[2*x] + row1[2*x+1]);
     }
 }
 
-static void convert_image_row_gray(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int width, void *user_data)
+#if DSSIM_X86_SIMD
+/*
+ * SIMD versions of downsample_rows_scalar(). They add the 4 pixels in the same order as the scalar expression
+ * (pairs of the first row, then even and odd pixels of the second), so usually results don't change with the CPU.
+ * -ffast-math lets the compiler regroup either sum, though, and in some builds (e.g. with -fsanitize=undefined) they differ by up to 2 ulp.
+ */
+__attribute__((target("sse4.1")))
+static void downsample_rows_sse41(const dssim_px_t *row0, const dssim_px_t *row1, dssim_px_t *restrict dstrow, const int n)
 {
-    image_data *im = (image_data*)user_data;
-    const unsigned char *row = im->row_pointers[y];
-    const dssim_px_t *const luma_lut = im->gamma_lut; // init converts it
-
-    for (int x = 0; x < width; x++) {
-        channels[0][x] = luma_lut[row[x]];
+    const __m128 quarter = _mm_set1_ps(0.25f);
+
+    int x=0;
+    for(; x+4 <= n; x+=4) {
+        const __m128 lo1 = _mm_loadu_ps(row1 + 2*x), hi1 = _mm_loadu_ps(row1 + 2*x+4);
+        const __m128 pairs0 = _mm_hadd_ps(_mm_loadu_ps(row0 + 2*x), _mm_loadu_ps(row0 + 2*x+4));
+        const __m128 even1 = _mm_shuffle_ps(lo1, hi1, _MM_SHUFFLE(2,0,2,0));
+        const __m128 odd1 = _mm_shuffle_ps(lo1, hi1, _MM_SHUFFLE(3,1,3,1));
+        _mm_storeu_ps(dstrow + x, _mm_mul_ps(_mm_add_ps(_mm_add_ps(pairs0, even1), odd1), quarter));
     }
+
+    downsample_rows_scalar(row0 + 2*x, row1 + 2*x, dstrow + x, n - x);
 }
 
-static void convert_u8_to_float(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int width, void *user_data)
+__attribute__((target("avx2")))
+static void downsample_rows_avx2(const dssim_px_t *row0, const dssim_px_t *row1, dssim_px_t *restrict dstrow, const int n)
 {
-    unsigned char *row = ((unsigned char **)user_data)[y];
-    for (int x = 0; x < width; x++) {
-        channels[0][x] = (*row++) / 255.f;
-        if (num_channels == 3) {
-            channels[1][x] = (*row++) / 255.f;
-            channels[2][x] = (*row++) / 255.f;
-        }
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+
+    int x=0;
+    for(; x+8 <= n; x+=8) {
+        // hadd and shuffle work within 128-bit lanes, so sums come out with halves of their order swapped, and are permuted back
+        const __m256 lo1 = _mm256_loadu_ps(row1 + 2*x), hi1 = _mm256_loadu_ps(row1 + 2*x+8);
+        const __m256 pairs0 = _mm256_hadd_ps(_mm256_loadu_ps(row0 + 2*x), _mm256_loadu_ps(row0 + 2*x+8));
+        const __m256 even1 = _mm256_shuffle_ps(lo1, hi1, _MM_SHUFFLE(2,0,2,0));
+        const __m256 odd1 = _mm256_shuffle_ps(lo1, hi1, _MM_SHUFFLE(3,1,3,1));
+        const __m256 sums = _mm256_add_ps(_mm256_add_ps(pairs0, even1), odd1);
+        const __m256d ordered = _mm256_permute4x64_pd(_mm256_castps_pd(sums), _MM_SHUFFLE(3,1,2,0));
+        _mm256_storeu_ps(dstrow + x, _mm256_mul_ps(_mm256_castpd_ps(ordered), quarter));
     }
+
+    downsample_rows_scalar(row0 + 2*x, row1 + 2*x, dstrow + x, n - x);
 }
+#endif
+
+typedef void downsample_rows_fn(const dssim_px_t *row0, const dssim_px_t *row1, dssim_px_t *restrict dstrow, const int n);
+
+static downsample_rows_fn *downsample_rows = downsample_rows_scalar;
 
 /*
- Copies the image.
+ * Conversion of one pixel between float and IEEE half precision, rounding to nearest even like F16C does.
+ * Values too large for half become infinity, and tiny ones become subnormal.
  */
-dssim_image *dssim_create_image(dssim_attr *attr, unsigned char *const *const row_pointers, dssim_colortype color_type, const int width, const int height, const double gamma)
+static uint16_t float_to_half(const float f)
 {
-    dssim_row_callback *converter;
-    int num_channels;
+    union { float f; uint32_t u; } v = {f};
+    const uint16_t sign = (v.u >> 16) & 0x8000;
+    v.u &= 0x7fffffff;
 
-    image_data im = {
-        .row_pointers = (const unsigned char *const *const )row_pointers,
-    };
+    if (v.u >= (127+16) << 23) { // too large, infinity or NaN
+        return sign | (v.u > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (v.u < (127-14) << 23) { // subnormal half, rounded by the float addition
+        const union { float f; uint32_t u; } magic = {.u = (127-15 + 23-10 + 1) << 23};
+        v.f += magic.f;
+        return sign | (v.u - magic.u);
+    }
+    const uint32_t mantissa_odd = (v.u >> 13) & 1;
+    v.u += ((uint32_t)(15-127) << 23) + 0xfff + mantissa_odd;
+    return sign | (v.u >> 13);
+}
 
-    if (!set_gamma(im.gamma_lut, gamma)) {
-        return NULL;
+static float half_to_float(const uint16_t h)
+{
+    const union { float f; uint32_t u; } magic = {.u = (127-15+1) << 23};
+    union { float f; uint32_t u; } v = {.u = (uint32_t)(h & 0x7fff) << 13};
+    const uint32_t exponent = v.u & (0x7c00 << 13);
+
+    v.u += (127-15) << 23;
+    if (exponent == 0x7c00 << 13) { // infinity or NaN
+        v.u += (128-16) << 23;
+    } else if (exponent == 0) { // subnormal, renormalized by the float subtraction
+        v.u += 1 << 23;
+        v.f -= magic.f;
     }
+    v.u |= (uint32_t)(h & 0x8000) << 16;
+    return v.f;
+}
 
-    switch(color_type) {
-        case DSSIM_GRAY:
-            convert_image_row_gray_init(im.gamma_lut);
-            converter = convert_image_row_gray;
-            num_channels = 1;
-            break;
-        case DSSIM_RGB:
-            converter = convert_image_row_rgb;
-            num_channels = 3;
-            break;
-        case DSSIM_RGBA:
-            converter = convert_image_row_rgba;
-            num_channels = 3;
-            break;
-        case DSSIM_RGBA_TO_GRAY:
-            converter = convert_image_row_rgba;
-            num_channels = 1;
-            break;
-        case DSSIM_LUMA:
-            converter = convert_u8_to_float;
-            num_channels = 1;
-            break;
-        case DSSIM_LAB:
-            converter = convert_u8_to_float;
-            num_channels = 3;
-            break;
-        default:
-            return NULL;
+static void float_to_half_scalar(const dssim_px_t *restrict src, uint16_t *restrict dst, const int n)
+{
+    for(int i=0; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
     }
+}
 
-    return dssim_create_image_float_callback(attr, num_channels, width, height, converter, (void*)&im);
+static void half_to_float_scalar(const uint16_t *restrict src, dssim_px_t *restrict dst, const int n)
+{
+    for(int i=0; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
 }
 
-static void dssim_preprocess_channel(dssim_chan *chan, dssim_px_t *tmp);
+#if DSSIM_X86_SIMD
+/*
+ * F16C versions of float_to_half_scalar() and half_to_float_scalar(), with identical results
+ */
+__attribute__((target("f16c")))
+static void float_to_half_f16c(const dssim_px_t *restrict src, uint16_t *restrict dst, const int n)
+{
+    int i=0;
+    for(; i+8 <= n; i+=8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for(; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
 
-dssim_image *dssim_create_image_float_callback(dssim_attr *attr, const int num_channels, const int width, const int height, dssim_row_callback cb, void *callback_user_data)
+__attribute__((target("f16c")))
+static void half_to_float_f16c(const uint16_t *restrict src, dssim_px_t *restrict dst, const int n)
 {
-    if (num_channels != 1 && num_channels != MAX_CHANS) {
-        return NULL;
+    int i=0;
+    for(; i+8 <= n; i+=8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+    for(; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
     }
+}
+#endif
 
-    const bool subsample_chroma = (width >= 8 && height >= 8) ? attr->subsample_chroma : false;
+typedef void float_to_half_fn(const dssim_px_t *restrict src, uint16_t *restrict dst, const int n);
+typedef void half_to_float_fn(const uint16_t *restrict src, dssim_px_t *restrict dst, const int n);
 
-    dssim_image *img = malloc(sizeof(img[0]));
-    *img = (dssim_image){
-        .num_channels = num_channels,
-    };
+static float_to_half_fn *float_to_half_px = float_to_half_scalar;
+static half_to_float_fn *half_to_float_px = half_to_float_scalar;
 
-    for (int ch = 0; ch < img->num_channels; ch++) {
-        const bool is_chroma = ch > 0;
-        int chan_width = subsample_chroma && is_chroma ? width/2 : width;
-        int chan_height = subsample_chroma && is_chroma ? height/2 : height;
-        int s = 0;
-        for(; s < attr->num_scales; s++) {
-            img->chan[ch].scales[s] = (dssim_chan){
-                .width = chan_width,
+static void dssim_init_kernels(void)
+{
+#if DSSIM_X86_SIMD
+    __builtin_cpu_init();
+#ifndef USE_COCOA // vImage picks the best blur implementation itself
+    if (__builtin_cpu_supports("avx2")) {
+        blur_row = blur_row_avx2;
+        blur_rows3 = blur_rows3_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        blur_row = blur_row_sse41;
+        blur_rows3 = blur_rows3_sse41;
+    }
+#endif
+    if (__builtin_cpu_supports("avx2")) {
+        downsample_rows = downsample_rows_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        downsample_rows = downsample_rows_sse41;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        linear_to_lab = linear_to_lab_avx2;
+        lab_lut_is_faster = false;
+    }
+    if (__builtin_cpu_supports("f16c")) {
+        float_to_half_px = float_to_half_f16c;
+        half_to_float_px = half_to_float_f16c;
+    }
+#endif
+}
+
+/*
+ * Pixels [offset, offset+n) of a plane stored either as float or as half. Half pixels are converted into buf.
+ */
+static const dssim_px_t *load_pixels(const dssim_px_t *img, const uint16_t *img_f16, const int offset, const int n, dssim_px_t *restrict buf)
+{
+    if (img) {
+        return img + offset;
+    }
+    half_to_float_px(img_f16 + offset, buf, n);
+    return buf;
+}
+
+/* Maximum number of planes blurred together by blur_planes() */
+#define BLUR_MAX_PLANES 2
+
+/* Input rows read above and below a band of output rows: 2 by a box blur, and 4 by two chained box blurs (see box_blur_chained()) */
+#define BLUR_REACH 2
+#define BLUR_CHAINED_REACH 4
+
+/* Copies of input rows just outside of a band (the halo), for all planes together */
+#define BLUR_HALO_MAX_ROWS (2 * BLUR_CHAINED_REACH)
+
+/* Rows of scratch memory used by each band: rings of 6 rows for up to 3 planes (in two chained blurs), 5 single rows, and the halo */
+#define BLUR_BAND_ROWS (3*6 + 5 + BLUR_HALO_MAX_ROWS)
+
+/* Bands are at least this tall, since each one also reads BLUR_CHAINED_REACH rows of its neighbours */
+#define BLUR_MIN_BAND_HEIGHT 16
+
+/*
+ * Supplies row y of each plane for blur_planes(). It can point rows[] at existing data,
+ * or compute the row into the corresponding scratch row and point to that.
+ */
+typedef void blur_input_fn(const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width, const void *user_data);
+
+/* Input for blurring a single plane (user_data) */
+static void blur_input_plane(const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width, const void *user_data)
+{
+    (void)scratch; // rows point into img
+    const dssim_px_t *img = user_data;
+    rows[0] = img + y*width;
+}
+
+/* Input for blurring img of the channel (user_data) and its square together */
+static void blur_input_img_and_sq(const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width, const void *user_data)
+{
+    const dssim_chan *const chan = user_data;
+    const dssim_px_t *const img_row = chan->img + y*chan->stride;
+    dssim_px_t *const sq_row = scratch[1];
+
+    for(int x=0; x < width; x++) {
+        sq_row[x] = img_row[x] * img_row[x];
+    }
+
+    rows[0] = img_row;
+    rows[1] = sq_row;
+}
+
+/* Input for blurring the product of img of two channels (user_data is an array of 2 pointers to them) */
+static void blur_input_product(const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width, const void *user_data)
+{
+    const dssim_chan *const *const chans = user_data;
+    const dssim_px_t *const row1 = chans[0]->img + y*chans[0]->stride;
+    const dssim_px_t *const row2 = chans[1]->img + y*chans[1]->stride;
+    dssim_px_t *const product_row = scratch[0];
+
+    for(int x=0; x < width; x++) {
+        product_row[x] = row1[x] * row2[x];
+    }
+
+    rows[0] = product_row;
+}
+
+/*
+ * Scratch memory used by each thread of blur_planes(), in pixels
+ */
+static size_t blur_band_tmp_size(const int width)
+{
+    return BLUR_BAND_ROWS * width;
+}
+
+/*
+ * Size of scratch memory needed by blur_planes()
+ */
+static size_t blur_tmp_size(const dssim_attr *attr, const int width, const int height)
+{
+    const size_t bands_size = dssim_num_threads(attr) * blur_band_tmp_size(width) * sizeof(dssim_px_t);
+#ifdef USE_COCOA
+    return MAX(MAX(height, BLUR_MAX_PLANES) * width * sizeof(dssim_px_t), bands_size);
+#else
+    (void)height; // only vImage blurs whole planes
+    return bands_size;
+#endif
+}
+
+/*
+ * Number of bands of rows processed in parallel
+ */
+static int blur_num_bands(const int threads, const int height)
+{
+    return MAX(1, MIN(threads, height / BLUR_MIN_BAND_HEIGHT));
+}
+
+/*
+ * First row of a band. Bands split rows evenly, and band n ends where band n+1 starts.
+ */
+static int band_start(const int band, const int bands, const int height)
+{
+    return (int)((long long)height * band / bands);
+}
+
+#ifndef USE_COCOA
+/* Copies of the halo rows of a band, made before any band writes its output */
+typedef struct {
+    int num_rows;
+    int y[BLUR_HALO_MAX_ROWS];
+    dssim_px_t *rows[BLUR_MAX_PLANES][BLUR_HALO_MAX_ROWS];
+} blur_halo;
+
+/*
+ * Gets input row y of a band, from the halo copy if there is one
+ */
+static void blur_band_input(const blur_halo *halo, const int num_planes, blur_input_fn *input, const void *input_data, const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width)
+{
+    if (halo) {
+        for(int i=0; i < halo->num_rows; i++) {
+            if (halo->y[i] == y) {
+                for(int p=0; p < num_planes; p++) {
+                    rows[p] = halo->rows[p][i];
+                }
+                return;
+            }
+        }
+    }
+    input(rows, scratch, y, width, input_data);
+}
+
+/*
+ * Copies input rows that are within reach of the band [y0, y1) but outside of it into the end of band_tmp.
+ * The rest of band_tmp is used as scratch for the input.
+ */
+static void blur_copy_halo(blur_halo *halo, dssim_px_t *restrict band_tmp, const int num_planes, const int reach, blur_input_fn *input, const void *input_data, const int y0, const int y1, const int width, const int height)
+{
+    assert(num_planes * 2 * reach <= BLUR_HALO_MAX_ROWS);
+    dssim_px_t *const halo_tmp = band_tmp + (BLUR_BAND_ROWS - BLUR_HALO_MAX_ROWS) * width;
+    dssim_px_t *scratch[BLUR_MAX_PLANES];
+    for(int p=0; p < BLUR_MAX_PLANES; p++) {
+        scratch[p] = band_tmp + p*width;
+    }
+    const dssim_px_t *rows[BLUR_MAX_PLANES];
+
+    halo->num_rows = 2 * reach;
+    for(int i=0; i < halo->num_rows; i++) {
+        const int y = i < reach ? y0 - reach + i : y1 + i - reach;
+        halo->y[i] = -1;
+        if (y < 0 || y >= height) {
+            continue;
+        }
+        input(rows, scratch, y, width, input_data);
+        for(int p=0; p < num_planes; p++) {
+            halo->rows[p][i] = halo_tmp + (p * halo->num_rows + i) * width;
+            memcpy(halo->rows[p][i], rows[p], width * sizeof(dssim_px_t));
+        }
+        halo->y[i] = y;
+    }
+}
+
+/* Rows of a streaming box blur of one plane. Row y of each pass is kept in slot y % 3. */
+typedef struct {
+    dssim_px_t *h_rows[3], *v_rows[3];
+} box_rings;
+
+/*
+ * Puts rings of num_planes planes at the start of tmp, and returns memory after them
+ */
+static dssim_px_t *box_rings_init(box_rings rings[], const int num_planes, dssim_px_t *tmp, const int width)
+{
+    for(int p=0; p < num_planes; p++) {
+        for(int i=0; i < 3; i++) {
+            rings[p].h_rows[i] = tmp + i*width;
+            rings[p].v_rows[i] = tmp + (3+i)*width;
+        }
+        tmp += 6*width;
+    }
+    return tmp;
+}
+
+/*
+ * Blurs input row y of each plane horizontally (rows is NULL past the last row), and makes row y-1 of the first vertical pass.
+ * Output rows from first_out onwards are made, so input starts at row first_out-2.
+ */
+static void box_blur_push(box_rings rings[], const int num_planes, const dssim_px_t *const rows[], dssim_px_t *restrict row_tmp, const int y, const int first_out, const int width, const int height)
+{
+    if (rows) {
+        for(int p=0; p < num_planes; p++) {
+            blur_row_twice(rows[p], row_tmp, rings[p].h_rows[y % 3], width);
+        }
+    }
+
+    const int v = y-1;
+    if (v >= MAX(first_out-1, 0) && v < height) {
+        for(int p=0; p < num_planes; p++) {
+            blur_rows3(rings[p].h_rows[MAX(v-1, 0) % 3], rings[p].h_rows[v % 3], rings[p].h_rows[MIN(v+1, height-1) % 3], rings[p].v_rows[v % 3], width);
+        }
+    }
+}
+
+/*
+ * Writes output row out of a plane, which is complete once input row out+2 has been pushed
+ */
+static void box_blur_pop(const box_rings *ring, dssim_px_t *restrict dstrow, const int out, const int width, const int height)
+{
+    blur_rows3(ring->v_rows[MAX(out-1, 0) % 3], ring->v_rows[out % 3], ring->v_rows[MIN(out+1, height-1) % 3], dstrow, width);
+}
+
+/*
+ * Writes rows [y0, y1) of the blur. Input rows from y0-2 to y1+1 are read, and edges of the image are repeated.
+ *
+ * Each input row is blurred horizontally into a ring of 3 rows, which feeds the first vertical pass into another ring of 3 rows,
+ * and an output row is written as soon as the window around it is complete. Only O(width) of tmp is used.
+ */
+static void box_blur_band(const int num_planes, blur_input_fn *input, const void *input_data, const blur_halo *halo, dssim_px_t *const dst[], dssim_px_t *restrict tmp, const int width, const int height, const int y0, const int y1)
+{
+    box_rings rings[BLUR_MAX_PLANES];
+    dssim_px_t *const rows_tmp = box_rings_init(rings, num_planes, tmp, width);
+    dssim_px_t *scratch[BLUR_MAX_PLANES];
+    for(int p=0; p < num_planes; p++) {
+        scratch[p] = rows_tmp + p*width;
+    }
+    dssim_px_t *const row_tmp = rows_tmp + num_planes*width;
+    const dssim_px_t *rows[BLUR_MAX_PLANES];
+
+    for(int y = MAX(y0-2, 0); y < y1+2; y++) {
+        if (y < height) {
+            blur_band_input(halo, num_planes, input, input_data, rows, scratch, y, width);
+        }
+        box_blur_push(rings, num_planes, y < height ? rows : NULL, row_tmp, y, y0, width, height);
+
+        const int out = y-2;
+        if (out >= y0) {
+            for(int p=0; p < num_planes; p++) {
+                box_blur_pop(&rings[p], dst[p] + out*width, out, width, height);
+            }
+        }
+    }
+}
+
+/*
+ * Same as box_blur_band(), but for two blurs in a row: img is blurred in place, and the result together with its square
+ * is blurred into mu and img_sq_blur. Rows of the first blur go to the second as soon as they are complete,
+ * so that img is swept only once. Input rows from y0-4 to y1+3 are read.
+ * With img_f16, rows of the first blur are rounded to half precision (kept in img_f16) before the second blur.
+ */
+static void box_blur_chained_band(dssim_px_t *img, uint16_t *img_f16, const blur_halo *halo, dssim_px_t *restrict mu, dssim_px_t *restrict img_sq_blur, dssim_px_t *restrict tmp, const int width, const int height, const int y0, const int y1)
+{
+    box_rings first[1], second[2];
+    dssim_px_t *const rows_tmp = box_rings_init(second, 2, box_rings_init(first, 1, tmp, width), width);
+    dssim_px_t *const row_tmp = rows_tmp;
+    dssim_px_t *const blurred_tmp = rows_tmp + width; // rows of the first blur outside of the band
+    dssim_px_t *const sq_row = rows_tmp + 2*width;
+    dssim_px_t *const scratch[BLUR_MAX_PLANES] = {rows_tmp + 3*width};
+    uint16_t *const half_tmp = (uint16_t *)(rows_tmp + 4*width);
+
+    // Rows [b0, b1) of the first blur are input of the second
+    const int b0 = MAX(y0-2, 0), b1 = MIN(y1+2, height);
+
+    for(int y = MAX(b0-2, 0); y < y1+4; y++) {
+        if (y < b1+2) {
+            const dssim_px_t *row;
+            if (y < height) {
+                blur_band_input(halo, 1, blur_input_plane, img, &row, scratch, y, width);
+            }
+            box_blur_push(first, 1, y < height ? &row : NULL, row_tmp, y, b0, width, height);
+        }
+
+        const int b = y-2;
+        if (b < b0 || b >= y1+2) {
+            continue;
+        }
+
+        const dssim_px_t *rows[2];
+        if (b < height) {
+            const bool in_band = b >= y0 && b < y1;
+            dssim_px_t *const blurred = in_band ? img + b*width : blurred_tmp;
+            box_blur_pop(&first[0], blurred, b, width, height);
+            if (img_f16) {
+                uint16_t *const blurred_f16 = in_band ? img_f16 + b*width : half_tmp;
+                float_to_half_px(blurred, blurred_f16, width);
+                half_to_float_px(blurred_f16, blurred, width);
+            }
+            for(int x=0; x < width; x++) {
+                sq_row[x] = blurred[x] * blurred[x];
+            }
+            rows[0] = blurred;
+            rows[1] = sq_row;
+        }
+        box_blur_push(second, 2, b < height ? rows : NULL, row_tmp, b, y0, width, height);
+
+        const int out = b-2;
+        if (out >= y0) {
+            box_blur_pop(&second[0], mu + out*width, out, width, height);
+            box_blur_pop(&second[1], img_sq_blur + out*width, out, width, height);
+        }
+    }
+}
+#endif
+
+/*
+ * blurs (approximate of gaussian) up to BLUR_MAX_PLANES planes at once, reading rows of all of them from the input callback.
+ *
+ * Planes are blurred in a single sweep over horizontal bands of rows, one band per thread. An input row is never requested
+ * after the output row in the same place has been written, so the input may read from dst (blur in place).
+ * Input rows around the edges of bands are copied before any band starts writing, so results don't depend on the number of threads.
+ */
+static void box_blur_planes(const int threads, const int num_planes, blur_input_fn *input, const void *input_data, dssim_px_t *const dst[], dssim_px_t *restrict tmp, const int width, const int height)
+{
+    assert(num_planes > 0 && num_planes <= BLUR_MAX_PLANES);
+    assert(input);
+    assert(dst);
+    assert(tmp);
+    assert(width > 4);
+    assert(height > 4);
+
+#ifdef USE_COCOA
+    (void)threads;
+    // vImage needs whole planes, so the input is gathered into dst first, and then blurred in place
+    const dssim_px_t *rows[BLUR_MAX_PLANES];
+    dssim_px_t *scratch[BLUR_MAX_PLANES];
+    for(int p=0; p < num_planes; p++) {
+        scratch[p] = tmp + p*width;
+    }
+    for(int y=0; y < height; y++) {
+        input(rows, scratch, y, width, input_data);
+        for(int p=0; p < num_planes; p++) {
+            if (rows[p] != dst[p] + y*width) {
+                memcpy(dst[p] + y*width, rows[p], width * sizeof(dssim_px_t));
+            }
+        }
+    }
+
+    dssim_px_t kernel[9] = {
+        1/16.f, 1/8.f, 1/16.f,
+        1/8.f,  1/4.f, 1/8.f,
+        1/16.f, 1/8.f, 1/16.f,
+    };
+
+    for(int p=0; p < num_planes; p++) {
+        vImage_Buffer dstbuf = {
+            .width = width,
+            .height = height,
+            .rowBytes = width * sizeof(dssim_px_t),
+            .data = dst[p],
+        };
+        vImage_Buffer tmpbuf = {
+            .width = width,
+            .height = height,
+            .rowBytes = width * sizeof(dssim_px_t),
+            .data = tmp,
+        };
+
+        vImageConvolve_PlanarF(&dstbuf, &tmpbuf, NULL, 0, 0, kernel, 3, 3, 0, kvImageEdgeExtend);
+        vImageConvolve_PlanarF(&tmpbuf, &dstbuf, NULL, 0, 0, kernel, 3, 3, 0, kvImageEdgeExtend);
+    }
+#else
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads)
+#else
+    (void)threads;
+#endif
+    {
+        const int band = omp_get_thread_num(), bands = blur_num_bands(omp_get_num_threads(), height);
+        const int y0 = band_start(band, bands, height), y1 = band_start(band+1, bands, height);
+        dssim_px_t *const band_tmp = tmp + band * blur_band_tmp_size(width);
+
+        blur_halo halo, *band_halo = NULL;
+        if (band < bands && bands > 1) {
+            blur_copy_halo(&halo, band_tmp, num_planes, BLUR_REACH, input, input_data, y0, y1, width, height);
+            band_halo = &halo;
+        }
+#ifdef _OPENMP
+        #pragma omp barrier
+#endif
+
+        if (band < bands) {
+            box_blur_band(num_planes, input, input_data, band_halo, dst, band_tmp, width, height, y0, y1);
+        }
+    }
+#endif
+}
+
+#ifndef USE_COCOA
+/*
+ * Blurs img in place, and then blurs the result and its square into mu and img_sq_blur, all in one sweep over bands of rows
+ * (see box_blur_chained_band()). Results are the same as of two box_blur_planes() calls.
+ */
+static void box_blur_chained(const int threads, dssim_px_t *img, uint16_t *img_f16, dssim_px_t *restrict mu, dssim_px_t *restrict img_sq_blur, dssim_px_t *restrict tmp, const int width, const int height)
+{
+    assert(width > 4);
+    assert(height > 4);
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads)
+#else
+    (void)threads;
+#endif
+    {
+        const int band = omp_get_thread_num(), bands = blur_num_bands(omp_get_num_threads(), height);
+        const int y0 = band_start(band, bands, height), y1 = band_start(band+1, bands, height);
+        dssim_px_t *const band_tmp = tmp + band * blur_band_tmp_size(width);
+
+        blur_halo halo, *band_halo = NULL;
+        if (band < bands && bands > 1) {
+            blur_copy_halo(&halo, band_tmp, 1, BLUR_CHAINED_REACH, blur_input_plane, img, y0, y1, width, height);
+            band_halo = &halo;
+        }
+#ifdef _OPENMP
+        #pragma omp barrier
+#endif
+
+        if (band < bands) {
+            box_blur_chained_band(img, img_f16, band_halo, mu, img_sq_blur, band_tmp, width, height, y0, y1);
+        }
+    }
+}
+#endif
+
+/*
+ * Causal and anti-causal passes of the recursive Gaussian over one row. Edge pixels are repeated.
+ * row and dstrow may be the same.
+ */
+static void gaussian_row(const dssim_px_t *row, dssim_px_t *dstrow, const int width, const dssim_px_t c[static 4])
+{
+    dssim_px_t w1 = row[0], w2 = row[0], w3 = row[0];
+    for(int x=0; x < width; x++) {
+        const dssim_px_t w = c[0] * row[x] + c[1] * w1 + c[2] * w2 + c[3] * w3;
+        dstrow[x] = w;
+        w3 = w2; w2 = w1; w1 = w;
+    }
+
+    w1 = w2 = w3 = dstrow[width-1];
+    for(int x=width-1; x >= 0; x--) {
+        const dssim_px_t w = c[0] * dstrow[x] + c[1] * w1 + c[2] * w2 + c[3] * w3;
+        dstrow[x] = w;
+        w3 = w2; w2 = w1; w1 = w;
+    }
+}
+
+/* Columns filtered together by the vertical pass of the recursive Gaussian */
+#define GAUSSIAN_STRIP_WIDTH 256
+
+/*
+ * One step of the vertical recursive Gaussian, updating row in place from 3 previously filtered rows
+ */
+static void gaussian_rows(const dssim_px_t *restrict r1, const dssim_px_t *restrict r2, const dssim_px_t *restrict r3, dssim_px_t *restrict row, const int width, const dssim_px_t c[static 4])
+{
+    for(int x=0; x < width; x++) {
+        row[x] = c[0] * row[x] + c[1] * r1[x] + c[2] * r2[x] + c[3] * r3[x];
+    }
+}
+
+/*
+ * Same as box_blur_planes(), but with a recursive Gaussian of any size. Cost per pixel doesn't depend on sigma.
+ * The vertical anti-causal pass needs whole columns, so dst is used for intermediate results.
+ * Rows are filtered in parallel bands, and columns in parallel strips. Input row y may only read row y of dst.
+ */
+static void gaussian_blur_planes(const int threads, const dssim_px_t coeffs[static 4], const int num_planes, blur_input_fn *input, const void *input_data, dssim_px_t *const dst[], dssim_px_t *restrict tmp, const int width, const int height)
+{
+    assert(num_planes > 0 && num_planes <= BLUR_MAX_PLANES);
+    assert(height > 1);
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads)
+#else
+    (void)threads;
+#endif
+    {
+        const int band = omp_get_thread_num(), bands = blur_num_bands(omp_get_num_threads(), height);
+        const dssim_px_t *rows[BLUR_MAX_PLANES];
+        dssim_px_t *scratch[BLUR_MAX_PLANES];
+        for(int p=0; p < num_planes; p++) {
+            scratch[p] = tmp + band * blur_band_tmp_size(width) + p*width;
+        }
+
+        for(int y = band_start(band, bands, height); band < bands && y < band_start(band+1, bands, height); y++) {
+            input(rows, scratch, y, width, input_data);
+            for(int p=0; p < num_planes; p++) {
+                gaussian_row(rows[p], dst[p] + y*width, width, coeffs);
+            }
+        }
+    }
+
+    // Filtered value of the edge rows is the same as their input, so clamping indices works as edge extension.
+    // Strips have a fixed width, so that the compiler's vectorized and scalar parts of the loop see the same pixels for any number of threads.
+    const int num_strips = (width + GAUSSIAN_STRIP_WIDTH - 1) / GAUSSIAN_STRIP_WIDTH;
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for(int strip = 0; strip < num_strips; strip++) {
+        const int x0 = strip * GAUSSIAN_STRIP_WIDTH;
+        const int strip_width = MIN(GAUSSIAN_STRIP_WIDTH, width - x0);
+
+        for(int p=0; p < num_planes; p++) {
+            dssim_px_t *const img = dst[p] + x0;
+            for(int y=1; y < height; y++) {
+                gaussian_rows(img + MAX(y-1, 0)*width, img + MAX(y-2, 0)*width, img + MAX(y-3, 0)*width, img + y*width, strip_width, coeffs);
+            }
+            for(int y=height-2; y >= 0; y--) {
+                gaussian_rows(img + MIN(y+1, height-1)*width, img + MIN(y+2, height-1)*width, img + MIN(y+3, height-1)*width, img + y*width, strip_width, coeffs);
+            }
+        }
+    }
+}
+
+/*
+ * Blurs planes with the window, using threads of attr
+ */
+static void blur_planes(const dssim_attr *attr, const blur_window *window, const int num_planes, blur_input_fn *input, const void *input_data, dssim_px_t *const dst[], dssim_px_t *restrict tmp, const int width, const int height)
+{
+    const int threads = dssim_num_threads(attr);
+    if (window->sigma > 0) {
+        gaussian_blur_planes(threads, window->gaussian_coeffs, num_planes, input, input_data, dst, tmp, width, height);
+    } else {
+        box_blur_planes(threads, num_planes, input, input_data, dst, tmp, width, height);
+    }
+}
+
+/* Two planes for blur_input_diff_sq(), each stored either as float or as half */
+typedef struct {
+    const dssim_px_t *img[2];
+    const uint16_t *img_f16[2];
+    size_t stride[2];
+} diff_input;
+
+/* Pixels of half planes converted at a time by blur_input_diff_sq() */
+#define DIFF_CHUNK 256
+
+/* Input for blurring the squared difference of two planes (user_data is diff_input) */
+static void blur_input_diff_sq(const dssim_px_t *rows[], dssim_px_t *const scratch[], const int y, const int width, const void *user_data)
+{
+    const diff_input *const in = user_data;
+    dssim_px_t *const diff_row = scratch[0];
+    dssim_px_t buf1[DIFF_CHUNK], buf2[DIFF_CHUNK];
+
+    for(int x=0; x < width; x += DIFF_CHUNK) {
+        const int n = MIN(DIFF_CHUNK, width - x);
+        const dssim_px_t *const px1 = load_pixels(in->img[0], in->img_f16[0], y*in->stride[0] + x, n, buf1);
+        const dssim_px_t *const px2 = load_pixels(in->img[1], in->img_f16[1], y*in->stride[1] + x, n, buf2);
+        for(int i=0; i < n; i++) {
+            const dssim_px_t d = px1[i] - px2[i];
+            diff_row[x+i] = d * d;
+        }
+    }
+
+    rows[0] = diff_row;
+}
+
+/*
+ * Fixed-point blur for 8-bit single-channel images (see dssim_set_fixed_point).
+ *
+ * Two 3-tap box blurs in each direction are a 5x5 kernel with integer weights that add up to 81,
+ * so summing instead of averaging is exact. Sums of pixels fit in 16 bits (at most 81*255),
+ * and sums of products of pixels in 32 bits (at most 81*255*255). Scaling is left to the SSIM formula.
+ */
+#define FIXED_BLUR_WEIGHT 81
+
+/* Rows of scratch memory used by each band of the fixed-point blur, which fits in blur_band_tmp_size() */
+#define FIXED_BLUR_ROWS 8
+
+static void sum3_row_u16(const uint16_t *restrict row, uint16_t *restrict dstrow, const int width)
+{
+    dstrow[0] = row[0] + row[0] + row[1];
+    for(int i=1; i < width-1; i++) {
+        dstrow[i] = row[i-1] + row[i] + row[i+1];
+    }
+    dstrow[width-1] = row[width-2] + row[width-1] + row[width-1];
+}
+
+static void sum3_rows_u16(const uint16_t *prev, const uint16_t *curr, const uint16_t *next, uint16_t *restrict dstrow, const int width)
+{
+    for(int i=0; i < width; i++) {
+        dstrow[i] = prev[i] + curr[i] + next[i];
+    }
+}
+
+static void sum3_row_u32(const uint32_t *restrict row, uint32_t *restrict dstrow, const int width)
+{
+    dstrow[0] = row[0] + row[0] + row[1];
+    for(int i=1; i < width-1; i++) {
+        dstrow[i] = row[i-1] + row[i] + row[i+1];
+    }
+    dstrow[width-1] = row[width-2] + row[width-1] + row[width-1];
+}
+
+static void sum3_rows_u32(const uint32_t *prev, const uint32_t *curr, const uint32_t *next, uint32_t *restrict dstrow, const int width)
+{
+    for(int i=0; i < width; i++) {
+        dstrow[i] = prev[i] + curr[i] + next[i];
+    }
+}
+
+/*
+ * Same sweep as box_blur_band(), writing 81 times the blur of img
+ */
+static void fixed_blur_band_u16(const unsigned char *restrict img, uint16_t *restrict dst, uint16_t *restrict tmp, const int width, const int height, const int y0, const int y1)
+{
+    uint16_t *h_rows[3], *v_rows[3];
+    for(int i=0; i < 3; i++) {
+        h_rows[i] = tmp + i*width;
+        v_rows[i] = tmp + (3+i)*width;
+    }
+    uint16_t *const in_row = tmp + 6*width;
+    uint16_t *const row_tmp = tmp + 7*width;
+
+    for(int y = MAX(y0-2, 0); y < y1+2; y++) {
+        if (y < height) {
+            const unsigned char *const src = img + y*width;
+            for(int x=0; x < width; x++) {
+                in_row[x] = src[x];
+            }
+            sum3_row_u16(in_row, row_tmp, width);
+            sum3_row_u16(row_tmp, h_rows[y % 3], width);
+        }
+        const int v = y-1;
+        if (v >= MAX(y0-1, 0) && v < height) {
+            sum3_rows_u16(h_rows[MAX(v-1, 0) % 3], h_rows[v % 3], h_rows[MIN(v+1, height-1) % 3], v_rows[v % 3], width);
+        }
+        const int out = y-2;
+        if (out >= y0) {
+            sum3_rows_u16(v_rows[MAX(out-1, 0) % 3], v_rows[out % 3], v_rows[MIN(out+1, height-1) % 3], dst + out*width, width);
+        }
+    }
+}
+
+/*
+ * Same as fixed_blur_band_u16(), but for the product img1*img2
+ */
+static void fixed_blur_band_u32(const unsigned char *img1, const unsigned char *img2, uint32_t *restrict dst, uint32_t *restrict tmp, const int width, const int height, const int y0, const int y1)
+{
+    uint32_t *h_rows[3], *v_rows[3];
+    for(int i=0; i < 3; i++) {
+        h_rows[i] = tmp + i*width;
+        v_rows[i] = tmp + (3+i)*width;
+    }
+    uint32_t *const in_row = tmp + 6*width;
+    uint32_t *const row_tmp = tmp + 7*width;
+
+    for(int y = MAX(y0-2, 0); y < y1+2; y++) {
+        if (y < height) {
+            const unsigned char *const src1 = img1 + y*width;
+            const unsigned char *const src2 = img2 + y*width;
+            for(int x=0; x < width; x++) {
+                in_row[x] = (uint32_t)src1[x] * src2[x];
+            }
+            sum3_row_u32(in_row, row_tmp, width);
+            sum3_row_u32(row_tmp, h_rows[y % 3], width);
+        }
+        const int v = y-1;
+        if (v >= MAX(y0-1, 0) && v < height) {
+            sum3_rows_u32(h_rows[MAX(v-1, 0) % 3], h_rows[v % 3], h_rows[MIN(v+1, height-1) % 3], v_rows[v % 3], width);
+        }
+        const int out = y-2;
+        if (out >= y0) {
+            sum3_rows_u32(v_rows[MAX(out-1, 0) % 3], v_rows[out % 3], v_rows[MIN(out+1, height-1) % 3], dst + out*width, width);
+        }
+    }
+}
+
+/*
+ * Fixed-point blur of img in parallel bands. The input is never written, so bands don't need halo copies.
+ */
+static void fixed_blur_u16(const int threads, const unsigned char *restrict img, uint16_t *restrict dst, dssim_px_t *restrict tmp, const int width, const int height)
+{
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads)
+#else
+    (void)threads;
+#endif
+    {
+        const int band = omp_get_thread_num(), bands = blur_num_bands(omp_get_num_threads(), height);
+        uint16_t *const band_tmp = (uint16_t *)(tmp + band * blur_band_tmp_size(width));
+        if (band < bands) {
+            fixed_blur_band_u16(img, dst, band_tmp, width, height, band_start(band, bands, height), band_start(band+1, bands, height));
+        }
+    }
+}
+
+/*
+ * Fixed-point blur of img1*img2 in parallel bands
+ */
+static void fixed_blur_u32(const int threads, const unsigned char *img1, const unsigned char *img2, uint32_t *restrict dst, dssim_px_t *restrict tmp, const int width, const int height)
+{
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads)
+#else
+    (void)threads;
+#endif
+    {
+        const int band = omp_get_thread_num(), bands = blur_num_bands(omp_get_num_threads(), height);
+        uint32_t *const band_tmp = (uint32_t *)(tmp + band * blur_band_tmp_size(width));
+        if (band < bands) {
+            fixed_blur_band_u32(img1, img2, dst, band_tmp, width, height, band_start(band, bands, height), band_start(band+1, bands, height));
+        }
+    }
+}
+
+/*
+ * Conversion is not reversible
+ */
+inline static linear_rgba composite_pixel_rgba(linear_rgba px, int i, int j)
+{
+    // Compose image on coloured background to better judge dissimilarity with various backgrounds
+    if (px.a < 255) {
+        int n = i ^ j;
+        if (n & 4) {
+            px.r += 1.0 - px.a; // assumes premultiplied alpha
+        }
+        if (n & 8) {
+            px.g += 1.0 - px.a;
+        }
+        if (n & 16) {
+            px.b += 1.0 - px.a;
+        }
+    }
+    return px;
+}
+
+/* copy number of rows from a 2x larger image */
+static void subsampled_copy(dssim_chan *new_chan, const int dest_y_offset, const int rows, const dssim_px_t *src_img, const int src_width)
+{
+    for(int y = 0; y < rows; y++) {
+        downsample_rows(&src_img[y*2 * src_width], &src_img[(y*2+1) * src_width], &new_chan->img[(y + dest_y_offset) * new_chan->width], new_chan->width);
+    }
+}
+
+/*
+ * Row y of scale s has just been written. If it completes a pair of rows, makes the row of the next scale from them,
+ * and so on down the pyramid, so that all scales are made in the same sweep as the full-size image, from rows still in cache.
+ */
+static void pyramid_push_row(dssim_image_chan *chan, const int s, const int y)
+{
+    if (s+1 >= chan->num_scales || !(y & 1)) {
+        return;
+    }
+    const dssim_chan *src = &chan->scales[s];
+    dssim_chan *dst = &chan->scales[s+1];
+    assert(y/2 < dst->height);
+    downsample_rows(&src->img[(y-1) * src->stride], &src->img[y * src->stride], &dst->img[(y/2) * dst->width], dst->width);
+    pyramid_push_row(chan, s+1, y/2);
+}
+
+/* same as subsampled_copy(), but from a fixed-point image */
+static void subsampled_copy_u8(dssim_chan *new_chan, const unsigned char *src_img, const int src_width)
+{
+    for(int y = 0; y < new_chan->height; y++) {
+        for(int x = 0; x < new_chan->width; x++) {
+            new_chan->img[x + y * new_chan->width] = (0.25f / 255.f) * (
+                src_img[x*2 + y*2 * src_width] + src_img[x*2+1 + y*2 * src_width] +
+                src_img[x*2 + (y*2+1) * src_width] + src_img[x*2+1 + (y*2+1) * src_width]
+            );
+        }
+    }
+}
+
+/*
+ * Number of rows given to a dssim_rows_callback at a time: as many as fit in about 256KB (the L2 cache of most CPUs),
+ * so that they're still in cache when they're subsampled. It's even, so that pairs of rows for subsampling aren't split.
+ */
+#define CALLBACK_BATCH_BYTES (256 * 1024)
+
+static int callback_batch_rows(const int num_channels, const int width, const int height)
+{
+    const int rows = CALLBACK_BATCH_BYTES / (num_channels * MAX(1, width) * sizeof(dssim_px_t));
+    return MIN(height, MAX(2, rows & ~1));
+}
+
+static void convert_image_subsampled(dssim_image *img, dssim_rows_callback cb, void *callback_user_data)
+{
+    dssim_chan *chan = &img->chan[0].scales[0];
+    const int width = chan->width;
+    const int height = chan->height;
+    const int batch_rows = callback_batch_rows(img->num_channels, width, height);
+
+    // Luma can be written directly (it's unscaled), and chroma is downsampled from the batch
+    dssim_px_t *chroma_tmp = malloc(width * batch_rows * (img->num_channels-1) * sizeof(chroma_tmp[0]));
+
+    for(int y = 0; y < height; y += batch_rows) {
+        const int rows = MIN(batch_rows, height - y);
+        dssim_px_t *const channels[MAX_CHANS] = {
+            &chan->img[width * y],
+            chroma_tmp,
+            chroma_tmp + width * batch_rows,
+        };
+        cb(channels, img->num_channels, y, rows, width, width, callback_user_data);
+
+        for(int i = 0; i < rows; i++) {
+            pyramid_push_row(&img->chan[0], 0, y + i);
+        }
+        // y is even. With an odd height the last row has no pair, and isn't used for chroma.
+        for(int ch = 1; ch < img->num_channels && img->chan[ch].num_scales; ch++) {
+            subsampled_copy(&img->chan[ch].scales[0], y/2, rows/2, channels[ch], width);
+            for(int i = 0; i < rows/2; i++) {
+                pyramid_push_row(&img->chan[ch], 0, y/2 + i);
+            }
+        }
+    }
+
+    free(chroma_tmp);
+}
+
+static void convert_image_simple(dssim_image *img, dssim_rows_callback cb, void *callback_user_data)
+{
+    dssim_chan *chan = &img->chan[0].scales[0];
+    const int width = chan->width;
+    const int height = chan->height;
+    const int batch_rows = callback_batch_rows(img->num_channels, width, height);
+
+    for(int y = 0; y < height; y += batch_rows) {
+        const int rows = MIN(batch_rows, height - y);
+        dssim_px_t *channels[MAX_CHANS];
+        for(int ch = 0; ch < img->num_channels; ch++) {
+            channels[ch] = &img->chan[ch].scales[0].img[width * y];
+        }
+        cb(channels, img->num_channels, y, rows, width, width, callback_user_data);
+        for(int ch = 0; ch < img->num_channels; ch++) {
+            for(int i = 0; i < rows; i++) {
+                pyramid_push_row(&img->chan[ch], 0, y + i);
+            }
+        }
+    }
+}
+
+/* Callback of dssim_create_image_float_callback(), which rows_from_row_callback() calls for each row */
+typedef struct {
+    dssim_row_callback *cb;
+    void *user_data;
+} row_callback_data;
+
+static void rows_from_row_callback(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int num_rows, const int width, const size_t stride, void *user_data)
+{
+    const row_callback_data *data = user_data;
+    for(int i = 0; i < num_rows; i++) {
+        dssim_px_t *row[MAX_CHANS];
+        for(int ch = 0; ch < num_channels; ch++) {
+            row[ch] = channels[ch] + i * stride;
+        }
+        data->cb(row, num_channels, y + i, width, data->user_data);
+    }
+}
+
+/* Rows of the caller's bitmap: either row pointers, or rows stride bytes apart (see dssim_create_image_strided()) */
+typedef struct {
+    const unsigned char *const *row_pointers; // NULL if rows are strided
+    const unsigned char *base;
+    size_t stride;
+} image_rows;
+
+inline static const unsigned char *image_row(const image_rows *rows, const int y)
+{
+    return rows->row_pointers ? rows->row_pointers[y] : rows->base + y * rows->stride;
+}
+
+typedef struct {
+    dssim_px_t gamma_lut[256];
+    image_rows rows;
+    const dssim_lab_lut *lab_lut; // NULL unless enabled with dssim_set_color_lut()
+} image_data;
+
+/* Pixels converted at a time by the built-in converters, which keep linear RGB of that many pixels on the stack for linear_to_lab(). Must be even. */
+#define LAB_CHUNK 64
+
+/*
+ * Converters of built-in color types below convert pixels [x0, x0+n) of row y, where n <= LAB_CHUNK, to out[ch][0..n-1].
+ * Like dssim_row_callback, only luma is written if num_channels is 1.
+ * They're inlined into pipelines (see CONVERT_PIPELINE_3), which make num_channels and use_lut constants.
+ */
+typedef void convert_chunk_fn(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[]);
+
+/*
+ * Lab of n <= LAB_CHUNK pixels of unblended 8-bit RGB, which are bytes_per_pixel apart
+ */
+ALWAYS_INLINE static void convert_rgb_pixels(const image_data *im, const unsigned char *px, const int bytes_per_pixel, dssim_px_t *const restrict out[], const int num_channels, const int n, const bool use_lut)
+{
+    if (use_lut) {
+        for (int i = 0; i < n; i++, px += bytes_per_pixel) {
+            const dssim_lab lab = lab_lut_lookup(im->lab_lut, px[0], px[1], px[2]);
+            out[0][i] = lab.l;
+            if (num_channels >= 3) {
+                out[1][i] = lab.A;
+                out[2][i] = lab.b;
+            }
+        }
+        return;
+    }
+
+    const dssim_px_t *const gamma_lut = im->gamma_lut;
+    dssim_px_t r[LAB_CHUNK], g[LAB_CHUNK], b[LAB_CHUNK];
+    for (int i = 0; i < n; i++, px += bytes_per_pixel) {
+        r[i] = gamma_lut[px[0]];
+        g[i] = gamma_lut[px[1]];
+        b[i] = gamma_lut[px[2]];
+    }
+    linear_to_lab(r, g, b, out[0], num_channels >= 3 ? out[1] : NULL, num_channels >= 3 ? out[2] : NULL, n);
+}
+
+/*
+ * Whether all n pixels have alpha of 255
+ */
+static bool rgba_opaque(const dssim_rgba *px, const int n)
+{
+    int i=0;
+#if DSSIM_X86_SIMD
+    __m128i all = _mm_set1_epi32(-1);
+    for(; i+4 <= n; i+=4) {
+        all = _mm_and_si128(all, _mm_loadu_si128((const __m128i *)(px + i)));
+    }
+    // Alpha is every 4th byte
+    if ((_mm_movemask_epi8(_mm_cmpeq_epi8(all, _mm_set1_epi32(-1))) & 0x8888) != 0x8888) {
+        return false;
+    }
+#endif
+    unsigned char all_a = 255;
+    for(; i < n; i++) {
+        all_a &= px[i].a;
+    }
+    return all_a == 255;
+}
+
+/*
+ * Opaque chunks skip premultiplication and compositing, which don't change opaque pixels.
+ * Chunks are the same either way, so linear_to_lab() gets the same input and the result is the same bit for bit.
+ */
+ALWAYS_INLINE static void convert_chunk_rgba(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int num_channels, const bool use_lut)
+{
+    const image_data *im = user_data;
+    const dssim_rgba *const row = (const dssim_rgba *)image_row(&im->rows, y) + x0;
+    const dssim_px_t *const gamma_lut = im->gamma_lut;
+
+    if (rgba_opaque(row, n)) {
+        convert_rgb_pixels(im, (const unsigned char *)row, sizeof(row[0]), out, num_channels, n, use_lut);
+        return;
+    }
+
+    dssim_px_t r[LAB_CHUNK], g[LAB_CHUNK], b[LAB_CHUNK];
+    int num_exact = 0, exact_i[LAB_CHUNK];
+    for (int i = 0; i < n; i++) {
+        // The table is of unblended colors, so translucent pixels, which are composited in linear light, are converted exactly
+        if (use_lut && row[i].a == 255) {
+            const dssim_lab px = lab_lut_lookup(im->lab_lut, row[i].r, row[i].g, row[i].b);
+            out[0][i] = px.l;
+            if (num_channels >= 3) {
+                out[1][i] = px.A;
+                out[2][i] = px.b;
+            }
+            continue;
+        }
+        const linear_rgba px = composite_pixel_rgba(rgb_to_linear(gamma_lut, row[i].r, row[i].g, row[i].b, row[i].a), x0 + i, y);
+        exact_i[num_exact] = i;
+        r[num_exact] = px.r;
+        g[num_exact] = px.g;
+        b[num_exact] = px.b;
+        num_exact++;
+    }
+
+    if (num_exact == n) {
+        linear_to_lab(r, g, b, out[0], num_channels >= 3 ? out[1] : NULL, num_channels >= 3 ? out[2] : NULL, n);
+    } else if (num_exact) {
+        dssim_px_t l[LAB_CHUNK], A[LAB_CHUNK], B[LAB_CHUNK];
+        linear_to_lab(r, g, b, l, num_channels >= 3 ? A : NULL, num_channels >= 3 ? B : NULL, num_exact);
+        for (int i = 0; i < num_exact; i++) {
+            out[0][exact_i[i]] = l[i];
+            if (num_channels >= 3) {
+                out[1][exact_i[i]] = A[i];
+                out[2][exact_i[i]] = B[i];
+            }
+        }
+    }
+
+    for (int ch = 0; ch < MIN(num_channels, 3); ch++) {
+        for (int i = 0; i < n; i++) {
+            assert(out[ch][i] >= 0.f && out[ch][i] <= 1.0f);
+        }
+    }
+}
+
+ALWAYS_INLINE static void convert_chunk_rgb(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int num_channels, const bool use_lut)
+{
+    const image_data *im = user_data;
+    convert_rgb_pixels(im, image_row(&im->rows, y) + x0 * sizeof(dssim_rgb), sizeof(dssim_rgb), out, num_channels, n, use_lut);
+}
+
+/*
+ * Clamps to 0-1, and NaN becomes 0. NaN is found by its bits, since -ffinite-math-only lets the compiler assume comparisons never see it.
+ */
+inline static dssim_px_t clamp_unit(const dssim_px_t v)
+{
+    const union { float f; uint32_t u; } bits = {v};
+    if ((bits.u & 0x7fffffff) > 0x7f800000) {
+        return 0;
+    }
+    return MIN(1.f, MAX(0.f, v));
+}
+
+/*
+ * Premultiplied linear RGBA of 4 floats per pixel (or halves, widened first) goes to linear_to_lab() without a gamma table.
+ * It's composited on the same checkerboard as DSSIM_RGBA, so it matches an 8-bit image with the same colors.
+ */
+ALWAYS_INLINE static void convert_chunk_linear_rgba(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int num_channels, const bool half)
+{
+    const image_data *im = user_data;
+    dssim_px_t widened[LAB_CHUNK * 4];
+    const dssim_px_t *px;
+    if (half) {
+        half_to_float_px((const uint16_t *)image_row(&im->rows, y) + x0 * 4, widened, n * 4);
+        px = widened;
+    } else {
+        px = (const dssim_px_t *)image_row(&im->rows, y) + x0 * 4;
+    }
+
+    dssim_px_t r[LAB_CHUNK], g[LAB_CHUNK], b[LAB_CHUNK];
+    for (int i = 0; i < n; i++, px += 4) {
+        // Clamped before compositing, so that a NaN color doesn't hide the background of a transparent pixel
+        const linear_rgba lin = composite_pixel_rgba((linear_rgba){
+            .r = clamp_unit(px[0]), .g = clamp_unit(px[1]), .b = clamp_unit(px[2]), .a = clamp_unit(px[3]),
+        }, x0 + i, y);
+        r[i] = MIN(1.f, lin.r);
+        g[i] = MIN(1.f, lin.g);
+        b[i] = MIN(1.f, lin.b);
+    }
+    linear_to_lab(r, g, b, out[0], num_channels >= 3 ? out[1] : NULL, num_channels >= 3 ? out[2] : NULL, n);
+}
+
+/*
+ * Turns the gamma table into a luma table. It's the same conversion as RGB pixels get, so that gray images match gray RGB.
+ */
+static void convert_image_row_gray_init(dssim_px_t gamma_lut[static 256]) {
+    dssim_px_t linear[256];
+    memcpy(linear, gamma_lut, sizeof(linear));
+    linear_to_lab(linear, linear, linear, gamma_lut, NULL, NULL, 256);
+}
+
+/*
+ * Luma of gray pixels, or the first byte of RGB(A) pixels with R==G==B
+ */
+ALWAYS_INLINE static void convert_chunk_gray(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int bytes_per_pixel)
+{
+    const image_data *im = user_data;
+    const unsigned char *row = image_row(&im->rows, y) + x0 * bytes_per_pixel;
+    const dssim_px_t *const luma_lut = im->gamma_lut; // init converts it
+
+    for (int i = 0; i < n; i++) {
+        out[0][i] = luma_lut[row[i * bytes_per_pixel]];
+    }
+}
+
+ALWAYS_INLINE static void convert_chunk_u8_to_float(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int num_channels)
+{
+    const image_data *im = user_data;
+    const unsigned char *row = image_row(&im->rows, y) + x0 * num_channels;
+    for (int i = 0; i < n; i++) {
+        out[0][i] = (*row++) / 255.f;
+        if (num_channels == 3) {
+            out[1][i] = (*row++) / 255.f;
+            out[2][i] = (*row++) / 255.f;
+        }
+    }
+}
+
+/* One color per bit of x^y that composite_pixel_rgba() looks at */
+#define CHECKERBOARD_COLORS 8
+
+typedef struct {
+    image_rows rows;
+    int background_mask; // 0 if the palette is opaque, otherwise CHECKERBOARD_COLORS-1
+    dssim_px_t lab[MAX_CHANS][CHECKERBOARD_COLORS][256];
+} indexed_image_data;
+
+/*
+ * Lab of the palette is computed once for each checkerboard color (just once if the palette is opaque),
+ * so conversion of pixels is only a lookup. Returns whether the palette is opaque gray.
+ */
+static bool convert_palette(indexed_image_data *im, const dssim_px_t gamma_lut[static 256], const dssim_rgba palette[], const int num_palette)
+{
+    bool opaque = true, gray = true;
+    for (int i = 0; i < num_palette; i++) {
+        if (palette[i].a != 255) {
+            opaque = false;
+        }
+        if (palette[i].r != palette[i].g || palette[i].r != palette[i].b) {
+            gray = false;
+        }
+    }
+    im->background_mask = opaque ? 0 : CHECKERBOARD_COLORS-1;
+
+    dssim_px_t r[256], g[256], b[256];
+    for (int bg = 0; bg <= im->background_mask; bg++) {
+        for (int i = 0; i < 256; i++) {
+            // Indices past the palette are black
+            const dssim_rgba px = i < num_palette ? palette[i] : (dssim_rgba){0, 0, 0, 255};
+            // Position with x^y == bg << 2 has the same background as pixels using this copy of the palette
+            const linear_rgba lin = composite_pixel_rgba(rgb_to_linear(gamma_lut, px.r, px.g, px.b, px.a), bg << 2, 0);
+            r[i] = lin.r;
+            g[i] = lin.g;
+            b[i] = lin.b;
+        }
+        linear_to_lab(r, g, b, im->lab[0][bg], im->lab[1][bg], im->lab[2][bg], 256);
+    }
+    return opaque && gray;
+}
+
+ALWAYS_INLINE static void convert_chunk_indexed(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[], const int num_channels)
+{
+    const indexed_image_data *im = user_data;
+    const unsigned char *row = image_row(&im->rows, y) + x0;
+
+    for (int ch = 0; ch < num_channels; ch++) {
+        for (int i = 0; i < n; i++) {
+            out[ch][i] = im->lab[ch][(((x0 + i) ^ y) >> 2) & im->background_mask][row[i]];
+        }
+    }
+}
+
+/*
+ * Body of the dssim_rows_callback of built-in color types. Pipelines call it with constant convert and num_channels.
+ */
+ALWAYS_INLINE static void convert_image_rows_chunks(convert_chunk_fn *convert, dssim_px_t *const restrict channels[], const int num_channels, const int y, const int num_rows, const int width, const size_t stride, const void *data)
+{
+    for (int i = 0; i < num_rows; i++) {
+        for (int x0 = 0; x0 < width; x0 += LAB_CHUNK) {
+            dssim_px_t *const out[MAX_CHANS] = {
+                channels[0] + i * stride + x0,
+                num_channels >= 3 ? channels[1] + i * stride + x0 : NULL,
+                num_channels >= 3 ? channels[2] + i * stride + x0 : NULL,
+            };
+            convert(data, y + i, x0, MIN(LAB_CHUNK, width - x0), out);
+        }
+    }
+}
+
+/*
+ * Converts pairs of rows of a 3-channel built-in color type by chunks, and writes full-size luma, subsampled chroma
+ * and (if there is one) the second scale of luma, while converted chunks are still on the stack.
+ * Smaller scales are made from these rows as they're completed.
+ */
+ALWAYS_INLINE static void convert_image_subsampled_chunks(convert_chunk_fn *convert, dssim_image *img, const void *data)
+{
+    assert(img->num_channels == MAX_CHANS);
+    dssim_chan *const luma = &img->chan[0].scales[0];
+    dssim_chan *const luma_half = img->chan[0].num_scales > 1 ? &img->chan[0].scales[1] : NULL;
+    const int width = luma->width;
+    const int height = luma->height;
+
+    for(int y = 0; y < height; y += 2) {
+        const int y_next = MIN(height-1, y+1);
+        const bool has_pair = y+1 < height;
+        for(int x0 = 0; x0 < width; x0 += LAB_CHUNK) {
+            const int n = MIN(LAB_CHUNK, width - x0);
+            dssim_px_t chroma[2][2][LAB_CHUNK]; // [row][channel]
+            dssim_px_t *const out0[MAX_CHANS] = {&luma->img[width * y + x0], chroma[0][0], chroma[0][1]};
+            dssim_px_t *const out1[MAX_CHANS] = {&luma->img[width * y_next + x0], chroma[1][0], chroma[1][1]};
+            convert(data, y, x0, n, out0);
+            convert(data, y_next, x0, n, out1);
+
+            if (!has_pair) {
+                continue;
+            }
+            // x0 is even, so the chunk has whole pairs of columns (except the last column of odd width, which is dropped)
+            for(int ch = 1; ch < MAX_CHANS; ch++) {
+                if (!img->chan[ch].num_scales) { // chroma too small to compare
+                    continue;
+                }
+                dssim_chan *const chan = &img->chan[ch].scales[0];
+                downsample_rows(chroma[0][ch-1], chroma[1][ch-1], &chan->img[chan->width * (y/2) + x0/2], n/2);
+            }
+            if (luma_half) {
+                downsample_rows(out0[0], out1[0], &luma_half->img[luma_half->width * (y/2) + x0/2], n/2);
+            }
+        }
+        if (has_pair) {
+            for(int ch = 0; ch < MAX_CHANS; ch++) {
+                if (ch > 0 ? img->chan[ch].num_scales > 0 : luma_half != NULL) {
+                    pyramid_push_row(&img->chan[ch], ch == 0 ? 1 : 0, y/2);
+                }
+            }
+        }
+    }
+}
+
+typedef void convert_subsampled_fn(dssim_image *img, const void *data);
+
+/*
+ * Conversion of a built-in color type. Every combination of color type, number of channels and options that changes
+ * the conversion has its own, generated by the macros below, so that conversion, subsampling and the second scale
+ * are compiled together for it, without checks or calls through pointers for each chunk. It's chosen once per image.
+ */
+typedef struct {
+    int num_channels;
+    dssim_rows_callback *convert_rows;
+    convert_subsampled_fn *convert_subsampled; // NULL if there's no chroma
+} convert_pipeline;
+
+/* convert_chunk is an expression converting a chunk of chans channels, using arguments of convert_chunk_fn */
+#define CONVERT_ROWS(name, chans, convert_chunk) \
+    static void pipeline_chunk_##name(const void *user_data, const int y, const int x0, const int n, dssim_px_t *const restrict out[]) { \
+        convert_chunk; \
+    } \
+    static void pipeline_rows_##name(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int num_rows, const int width, const size_t stride, void *user_data) { \
+        (void)num_channels; /* it's only checked with assert() */ \
+        assert(num_channels == chans); \
+        convert_image_rows_chunks(pipeline_chunk_##name, channels, chans, y, num_rows, width, stride, user_data); \
+    }
+
+#define CONVERT_PIPELINE_1(name, convert_chunk) \
+    CONVERT_ROWS(name, 1, convert_chunk) \
+    static const convert_pipeline pipeline_##name = {1, pipeline_rows_##name, NULL};
+
+#define CONVERT_PIPELINE_3(name, convert_chunk) \
+    CONVERT_ROWS(name, 3, convert_chunk) \
+    static void pipeline_subsampled_##name(dssim_image *img, const void *data) { \
+        convert_image_subsampled_chunks(pipeline_chunk_##name, img, data); \
+    } \
+    static const convert_pipeline pipeline_##name = {3, pipeline_rows_##name, pipeline_subsampled_##name};
+
+CONVERT_PIPELINE_3(rgb, convert_chunk_rgb(user_data, y, x0, n, out, 3, false))
+CONVERT_PIPELINE_3(rgb_lut, convert_chunk_rgb(user_data, y, x0, n, out, 3, true))
+CONVERT_PIPELINE_3(rgba, convert_chunk_rgba(user_data, y, x0, n, out, 3, false))
+CONVERT_PIPELINE_3(rgba_lut, convert_chunk_rgba(user_data, y, x0, n, out, 3, true))
+CONVERT_PIPELINE_1(rgba_to_gray, convert_chunk_rgba(user_data, y, x0, n, out, 1, false))
+CONVERT_PIPELINE_1(rgba_to_gray_lut, convert_chunk_rgba(user_data, y, x0, n, out, 1, true))
+CONVERT_PIPELINE_1(gray, convert_chunk_gray(user_data, y, x0, n, out, 1))
+CONVERT_PIPELINE_1(gray_rgb, convert_chunk_gray(user_data, y, x0, n, out, 3))
+CONVERT_PIPELINE_1(gray_rgba, convert_chunk_gray(user_data, y, x0, n, out, 4))
+CONVERT_PIPELINE_1(luma, convert_chunk_u8_to_float(user_data, y, x0, n, out, 1))
+CONVERT_PIPELINE_3(lab, convert_chunk_u8_to_float(user_data, y, x0, n, out, 3))
+CONVERT_PIPELINE_3(linear_rgba_f32, convert_chunk_linear_rgba(user_data, y, x0, n, out, 3, false))
+CONVERT_PIPELINE_3(linear_rgba_f16, convert_chunk_linear_rgba(user_data, y, x0, n, out, 3, true))
+CONVERT_PIPELINE_1(indexed_gray, convert_chunk_indexed(user_data, y, x0, n, out, 1))
+CONVERT_PIPELINE_3(indexed, convert_chunk_indexed(user_data, y, x0, n, out, 3))
+
+static void dssim_preprocess_channel(const dssim_attr *attr, dssim_chan *chan, dssim_px_t *tmp);
+static void blur_chan(const dssim_attr *attr, dssim_chan *chan, dssim_px_t *tmp);
+static void dssim_chan_to_half(dssim_chan *chan);
+
+/*
+ Allocates planes of all scales. With fixed_point the full-size scale gets img_u8 instead of img.
+ If there are borrowed planes (rows borrowed_stride pixels apart), they're used as img of the full-size scale,
+ except for subsampled chroma, which has to be made from them.
+ */
+static dssim_image *dssim_alloc_image(const dssim_attr *attr, const int num_channels, const int width, const int height, const bool subsample_chroma, const bool fixed_point, const bool is_gray, const dssim_px_t *const borrowed[], const size_t borrowed_stride)
+{
+    dssim_image *img = malloc(sizeof(img[0]));
+    *img = (dssim_image){
+        .num_channels = num_channels,
+        .is_gray = is_gray,
+    };
+    pthread_mutex_init(&img->blur_lock, NULL);
+
+    for (int ch = 0; ch < (is_gray ? MAX_CHANS : img->num_channels); ch++) {
+        const bool is_chroma = ch > 0;
+        const bool is_stored = ch < img->num_channels;
+        int chan_width = subsample_chroma && is_chroma ? width/2 : width;
+        int chan_height = subsample_chroma && is_chroma ? height/2 : height;
+        int s = 0;
+        // A scale is only used if the next one would be at least 8x8
+        for(; s < attr->num_scales && chan_width/2 >= 8 && chan_height/2 >= 8; s++) {
+            const bool is_fixed = fixed_point && s == 0;
+            const bool is_borrowed = borrowed && s == 0 && !(subsample_chroma && is_chroma);
+            img->chan[ch].scales[s] = (dssim_chan){
+                .width = chan_width,
                 .height = chan_height,
+                .stride = is_borrowed ? borrowed_stride : (size_t)chan_width,
                 .is_chroma = is_chroma,
-                .img = malloc(chan_width * chan_height * sizeof(img->chan[ch].scales[s].img[0])),
+                .half_storage = attr->half_storage,
+                .blur = attr->blur,
+                // The caller's plane is const, but img_borrowed keeps it from being written
+                .img = !is_stored || is_fixed ? NULL : is_borrowed ? (dssim_px_t *)borrowed[ch] : malloc(chan_width * chan_height * sizeof(img->chan[ch].scales[s].img[0])),
+                .img_borrowed = is_borrowed,
+                .img_u8 = is_stored && is_fixed ? malloc(chan_width * chan_height) : NULL,
             };
             chan_width /= 2;
             chan_height /= 2;
-            if (chan_width < 8 || chan_height < 8) {
-                break;
+        }
+        img->chan[ch].num_scales = s;
+    }
+
+    for (int ch = 0; ch < img->num_channels; ch++) {
+        for (int s = 0; s < img->chan[ch].num_scales; s++) {
+            assert(img->chan[ch].scales[s].img || img->chan[ch].scales[s].img_u8);
+        }
+    }
+
+    return img;
+}
+
+/*
+ Single-channel 8-bit image for the fixed-point path. lut maps pixels to 8-bit luma.
+ */
+static dssim_image *dssim_create_image_fixed(dssim_attr *attr, const image_rows *rows, const unsigned char lut[static 256], const int width, const int height)
+{
+    dssim_image *img = dssim_alloc_image(attr, 1, width, height, false, true, false, NULL, 0);
+    if (!img->chan[0].num_scales) { // too small to compare
+        return img;
+    }
+
+    unsigned char *const img_u8 = img->chan[0].scales[0].img_u8;
+    for(int y = 0; y < height; y++) {
+        const unsigned char *const row = image_row(rows, y);
+        for(int x = 0; x < width; x++) {
+            img_u8[x + y*width] = lut[row[x]];
+        }
+    }
+
+    dssim_image_chan *const chan = &img->chan[0];
+    if (chan->num_scales > 1) {
+        subsampled_copy_u8(&chan->scales[1], img_u8, width);
+        for(int y = 0; y < chan->scales[1].height; y++) {
+            pyramid_push_row(chan, 1, y);
+        }
+    }
+
+    return img;
+}
+
+static dssim_image *dssim_create_image_channels(dssim_attr *attr, const int num_channels, const bool is_gray, const int width, const int height, dssim_rows_callback cb, convert_subsampled_fn *convert_subsampled, void *callback_user_data);
+static dssim_image *dssim_create_image_rows(dssim_attr *attr, const image_rows *rows, dssim_colortype color_type, const int width, const int height, const double gamma);
+
+/*
+ Whether all pixels have R==G==B. Translucent pixels are composited on a colored checkerboard, so they aren't gray.
+ */
+static bool rows_are_gray(const image_rows *rows, const int bytes_per_pixel, const int width, const int height)
+{
+    for (int y = 0; y < height; y++) {
+        const unsigned char *px = image_row(rows, y);
+        for (int x = 0; x < width; x++, px += bytes_per_pixel) {
+            if (px[0] != px[1] || px[0] != px[2] || (bytes_per_pixel == 4 && px[3] != 255)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ Copies the image.
+ */
+dssim_image *dssim_create_image(dssim_attr *attr, unsigned char *const *const row_pointers, dssim_colortype color_type, const int width, const int height, const double gamma)
+{
+    const image_rows rows = {.row_pointers = (const unsigned char *const *)row_pointers};
+    return dssim_create_image_rows(attr, &rows, color_type, width, height, gamma);
+}
+
+dssim_image *dssim_create_image_strided(dssim_attr *attr, const unsigned char *base, const size_t stride, dssim_colortype color_type, const int width, const int height, const double gamma)
+{
+    const image_rows rows = {.base = base, .stride = stride};
+    return dssim_create_image_rows(attr, &rows, color_type, width, height, gamma);
+}
+
+static dssim_image *dssim_create_image_rows(dssim_attr *attr, const image_rows *rows, dssim_colortype color_type, const int width, const int height, const double gamma)
+{
+    const convert_pipeline *pipeline;
+    bool is_gray = false;
+
+    image_data im = {
+        .rows = *rows,
+    };
+
+    const bool is_linear = color_type == DSSIM_LINEAR_RGBA_F32 || color_type == DSSIM_LINEAR_RGBA_F16;
+    if (!set_gamma(im.gamma_lut, gamma) && !is_linear) {
+        return NULL;
+    }
+
+    switch(color_type) {
+        case DSSIM_GRAY:
+        case DSSIM_GRAY_TO_RGB:
+            convert_image_row_gray_init(im.gamma_lut);
+            pipeline = &pipeline_gray;
+            is_gray = color_type == DSSIM_GRAY_TO_RGB;
+            break;
+        case DSSIM_RGB:
+            pipeline = &pipeline_rgb;
+            break;
+        case DSSIM_RGBA:
+            pipeline = &pipeline_rgba;
+            break;
+        case DSSIM_RGBA_TO_GRAY:
+            pipeline = &pipeline_rgba_to_gray;
+            break;
+        case DSSIM_LUMA:
+            pipeline = &pipeline_luma;
+            break;
+        case DSSIM_LAB:
+            pipeline = &pipeline_lab;
+            break;
+        case DSSIM_LINEAR_RGBA_F32:
+            pipeline = &pipeline_linear_rgba_f32;
+            break;
+        case DSSIM_LINEAR_RGBA_F16:
+            pipeline = &pipeline_linear_rgba_f16;
+            break;
+        default:
+            return NULL;
+    }
+
+    if ((color_type == DSSIM_RGB || color_type == DSSIM_RGBA) && rows_are_gray(rows, color_type == DSSIM_RGB ? 3 : 4, width, height)) {
+        convert_image_row_gray_init(im.gamma_lut);
+        pipeline = color_type == DSSIM_RGB ? &pipeline_gray_rgb : &pipeline_gray_rgba;
+        is_gray = true;
+    }
+
+    if (attr->color_lut && lab_lut_is_faster && (pipeline == &pipeline_rgb || pipeline == &pipeline_rgba || pipeline == &pipeline_rgba_to_gray)) {
+        im.lab_lut = dssim_get_lab_lut(attr, gamma);
+        pipeline = pipeline == &pipeline_rgb ? &pipeline_rgb_lut : pipeline == &pipeline_rgba ? &pipeline_rgba_lut : &pipeline_rgba_to_gray_lut;
+    }
+
+    if (attr->fixed_point && attr->blur.sigma == 0 && (color_type == DSSIM_GRAY || color_type == DSSIM_LUMA) && width >= 8 && height >= 8) {
+        unsigned char lut[256];
+        for(int i=0; i < 256; i++) {
+            lut[i] = color_type == DSSIM_GRAY ? lrintf(im.gamma_lut[i] * 255.f) : i;
+        }
+        return dssim_create_image_fixed(attr, rows, lut, width, height);
+    }
+
+    return dssim_create_image_channels(attr, pipeline->num_channels, is_gray, width, height, pipeline->convert_rows, pipeline->convert_subsampled, &im);
+}
+
+/*
+ Copies the image. Pixels are 1-byte indices into the palette.
+ */
+dssim_image *dssim_create_image_indexed(dssim_attr *attr, unsigned char *const *const row_pointers, const dssim_rgba palette[], const int num_palette, const int width, const int height, const double gamma)
+{
+    dssim_px_t gamma_lut[256];
+    if (!set_gamma(gamma_lut, gamma) || num_palette < 0 || num_palette > 256) {
+        return NULL;
+    }
+
+    indexed_image_data *im = malloc(sizeof(im[0]));
+    im->rows = (image_rows){.row_pointers = (const unsigned char *const *)row_pointers};
+    const bool is_gray = convert_palette(im, gamma_lut, palette, num_palette);
+
+    const convert_pipeline *pipeline = is_gray ? &pipeline_indexed_gray : &pipeline_indexed;
+    dssim_image *img = dssim_create_image_channels(attr, pipeline->num_channels, is_gray, width, height, pipeline->convert_rows, pipeline->convert_subsampled, im);
+    free(im);
+    return img;
+}
+
+dssim_image *dssim_create_image_float_callback(dssim_attr *attr, const int num_channels, const int width, const int height, dssim_row_callback cb, void *callback_user_data)
+{
+    row_callback_data data = {cb, callback_user_data};
+    return dssim_create_image_float_callback_rows(attr, num_channels, width, height, rows_from_row_callback, &data);
+}
+
+dssim_image *dssim_create_image_float_callback_rows(dssim_attr *attr, const int num_channels, const int width, const int height, dssim_rows_callback cb, void *callback_user_data)
+{
+    if (num_channels != 1 && num_channels != MAX_CHANS) {
+        return NULL;
+    }
+    return dssim_create_image_channels(attr, num_channels, false, width, height, cb, NULL, callback_user_data);
+}
+
+dssim_image *dssim_create_image_float_planes(dssim_attr *attr, const int num_channels, const dssim_px_t *const planes[], const size_t stride, const int width, const int height)
+{
+    if ((num_channels != 1 && num_channels != MAX_CHANS) || stride < (size_t)width) {
+        return NULL;
+    }
+    const bool subsample_chroma = (width >= 8 && height >= 8) ? attr->subsample_chroma : false;
+
+    dssim_image *img = dssim_alloc_image(attr, num_channels, width, height, subsample_chroma, false, false, planes, stride);
+
+    for (int ch = 0; ch < num_channels; ch++) {
+        dssim_image_chan *const chan = &img->chan[ch];
+        if (!chan->num_scales) { // too small to compare
+            continue;
+        }
+        dssim_chan *const full = &chan->scales[0];
+        for (int y = 0; y < full->height; y++) {
+            if (!full->img_borrowed) { // subsampled chroma
+                downsample_rows(planes[ch] + y*2 * stride, planes[ch] + (y*2+1) * stride, &full->img[y * full->width], full->width);
             }
+            pyramid_push_row(chan, 0, y);
         }
-        img->chan[ch].num_scales = s;
     }
 
-    for (int ch = 0; ch < img->num_channels; ch++) {
-        for (int s = 0; s < img->chan[ch].num_scales; s++) {
-            assert(img->chan[ch].scales[s].img);
-        }
+    return img;
+}
+
+/* Levels of R', G' and B' in ycbcr_image_data.linear_lut, enough for 10-bit video */
+#define YCBCR_RGB_LEVELS 1024
+
+typedef struct {
+    const unsigned char *planes[3];
+    size_t strides[3];
+    bool ten_bit;
+    int num_codes;
+    dssim_px_t y_offset, y_scale, c_offset, c_scale; // normalized sample = (code - offset) * scale
+    dssim_px_t cr_to_r, cb_to_g, cr_to_g, cb_to_b;
+    dssim_px_t luma_lut[YCBCR_RGB_LEVELS]; // L of gray with the Y' code (num_codes of them)
+    dssim_px_t linear_lut[YCBCR_RGB_LEVELS]; // linear value of R', G' or B'
+} ycbcr_image_data;
+
+inline static int ycbcr_code(const ycbcr_image_data *im, const int plane, const int x, const int y)
+{
+    const unsigned char *row = im->planes[plane] + y * im->strides[plane];
+    return MIN(im->num_codes - 1, im->ten_bit ? ((const uint16_t *)row)[x] : row[x]);
+}
+
+inline static dssim_px_t ycbcr_luma(const ycbcr_image_data *im, const int x, const int y)
+{
+    return (ycbcr_code(im, 0, x, y) - im->y_offset) * im->y_scale;
+}
+
+inline static dssim_px_t ycbcr_chroma(const ycbcr_image_data *im, const int plane, const int x, const int y)
+{
+    return (ycbcr_code(im, plane, x, y) - im->c_offset) * im->c_scale;
+}
+
+inline static dssim_px_t ycbcr_to_linear(const ycbcr_image_data *im, const dssim_px_t v)
+{
+    return im->linear_lut[(int)lrintf(MIN(1.f, MAX(0.f, v)) * (YCBCR_RGB_LEVELS-1))];
+}
+
+static void ycbcr_init(ycbcr_image_data *im, const bool ten_bit, const bool bt709, const double gamma)
+{
+    // Limited ("video") range
+    im->ten_bit = ten_bit;
+    im->num_codes = ten_bit ? 1024 : 256;
+    im->y_offset = ten_bit ? 64 : 16;
+    im->y_scale = 1.f / (ten_bit ? 876 : 219);
+    im->c_offset = ten_bit ? 512 : 128;
+    im->c_scale = 1.f / (ten_bit ? 896 : 224);
+
+    const double kr = bt709 ? 0.2126 : 0.299, kb = bt709 ? 0.0722 : 0.114, kg = 1.0 - kr - kb;
+    im->cr_to_r = 2.0 * (1.0 - kr);
+    im->cb_to_b = 2.0 * (1.0 - kb);
+    im->cb_to_g = 2.0 * kb * (1.0 - kb) / kg;
+    im->cr_to_g = 2.0 * kr * (1.0 - kr) / kg;
+
+    for (int i = 0; i < YCBCR_RGB_LEVELS; i++) {
+        im->linear_lut[i] = gamma_to_linear(i / (double)(YCBCR_RGB_LEVELS-1), gamma);
     }
 
-    if (subsample_chroma && img->num_channels > 1) {
-        convert_image_subsampled(img, cb, callback_user_data);
-    } else {
-        convert_image_simple(img, cb, callback_user_data);
+    dssim_px_t gray[YCBCR_RGB_LEVELS];
+    for (int code = 0; code < im->num_codes; code++) {
+        gray[code] = gamma_to_linear(MIN(1.0, MAX(0.0, (code - im->y_offset) * (double)im->y_scale)), gamma);
     }
+    linear_to_lab(gray, gray, gray, im->luma_lut, NULL, NULL, im->num_codes);
+}
 
+/*
+ * a and b of n <= LAB_CHUNK pixels with normalized Y'CbCr
+ */
+static void ycbcr_to_chroma(const ycbcr_image_data *im, const dssim_px_t luma[], const dssim_px_t cb[], const dssim_px_t cr[], dssim_px_t *restrict a, dssim_px_t *restrict b, const int n)
+{
+    dssim_px_t r[LAB_CHUNK], g[LAB_CHUNK], bl[LAB_CHUNK], l[LAB_CHUNK];
+    for (int i = 0; i < n; i++) {
+        r[i] = ycbcr_to_linear(im, luma[i] + im->cr_to_r * cr[i]);
+        g[i] = ycbcr_to_linear(im, luma[i] - im->cb_to_g * cb[i] - im->cr_to_g * cr[i]);
+        bl[i] = ycbcr_to_linear(im, luma[i] + im->cb_to_b * cb[i]);
+    }
+    linear_to_lab(r, g, bl, l, a, b, n);
+}
 
-    for (int ch = 0; ch < img->num_channels; ch++) {
-        for (int s = 0; s < img->chan[ch].num_scales; s++) {
-            assert(img->chan[ch].scales[s].img);
+/*
+ Luma goes straight to the luma channel through a table of L of gray, which is exact for neutral colors, and
+ for other colors differs from the true L as much as Y' differs from luminance.
+ Chroma is converted (with Y' averaged over the same pixels) at the resolution of chroma channels, so chroma of 4:2:0
+ isn't subsampled again when chroma subsampling is enabled, and is repeated for 2x2 pixels when it's not.
+ */
+dssim_image *dssim_create_image_ycbcr(dssim_attr *attr, const void *const planes[3], const size_t strides[3], dssim_colortype color_type, const int width, const int height, const double gamma)
+{
+    const int format = color_type & ~(DSSIM_YCBCR_BT709 | DSSIM_YCBCR_10BIT);
+    if ((format != DSSIM_YCBCR420 && format != DSSIM_YCBCR444) || !valid_gamma(gamma)) {
+        return NULL;
+    }
+    const bool is420 = format == DSSIM_YCBCR420;
+
+    ycbcr_image_data im = {
+        .planes = {planes[0], planes[1], planes[2]},
+        .strides = {strides[0], strides[1], strides[2]},
+    };
+    ycbcr_init(&im, color_type & DSSIM_YCBCR_10BIT, color_type & DSSIM_YCBCR_BT709, gamma);
+
+    const bool subsample_chroma = (width >= 8 && height >= 8) ? attr->subsample_chroma : false;
+    dssim_image *img = dssim_alloc_image(attr, MAX_CHANS, width, height, subsample_chroma, false, false, NULL, 0);
+
+    dssim_image_chan *const luma = &img->chan[0];
+    if (luma->num_scales) {
+        for (int y = 0; y < height; y++) {
+            dssim_px_t *const row = &luma->scales[0].img[y * width];
+            for (int x = 0; x < width; x++) {
+                row[x] = im.luma_lut[ycbcr_code(&im, 0, x, y)];
+            }
+            pyramid_push_row(luma, 0, y);
         }
     }
 
-    dssim_px_t *tmp = dssim_get_tmp(attr, width * height * sizeof(tmp[0]));
-    for (int ch = 0; ch < img->num_channels; ch++) {
-        const dssim_chan *prev_chan = &img->chan[ch].scales[0];
-        for (int s = 1; s < img->chan[ch].num_scales; s++) {
-            dssim_chan *new_chan = &img->chan[ch].scales[s];
-            subsampled_copy(new_chan, 0, new_chan->height, prev_chan->img, prev_chan->width);
-            prev_chan = new_chan;
+    if (!img->chan[1].num_scales) { // too small to compare
+        return img;
+    }
+    dssim_chan *const chroma_a = &img->chan[1].scales[0], *const chroma_b = &img->chan[2].scales[0];
+    for (int cy = 0; cy < chroma_a->height; cy++) {
+        for (int cx0 = 0; cx0 < chroma_a->width; cx0 += LAB_CHUNK) {
+            const int n = MIN(LAB_CHUNK, chroma_a->width - cx0);
+            dssim_px_t yv[LAB_CHUNK], cb[LAB_CHUNK], cr[LAB_CHUNK];
+            for (int i = 0; i < n; i++) {
+                const int cx = cx0 + i;
+                if (subsample_chroma) {
+                    const int x = cx*2, y = cy*2;
+                    yv[i] = 0.25f * (ycbcr_luma(&im, x, y) + ycbcr_luma(&im, x+1, y) + ycbcr_luma(&im, x, y+1) + ycbcr_luma(&im, x+1, y+1));
+                    if (is420) {
+                        cb[i] = ycbcr_chroma(&im, 1, cx, cy);
+                        cr[i] = ycbcr_chroma(&im, 2, cx, cy);
+                    } else {
+                        cb[i] = 0.25f * (ycbcr_chroma(&im, 1, x, y) + ycbcr_chroma(&im, 1, x+1, y) + ycbcr_chroma(&im, 1, x, y+1) + ycbcr_chroma(&im, 1, x+1, y+1));
+                        cr[i] = 0.25f * (ycbcr_chroma(&im, 2, x, y) + ycbcr_chroma(&im, 2, x+1, y) + ycbcr_chroma(&im, 2, x, y+1) + ycbcr_chroma(&im, 2, x+1, y+1));
+                    }
+                } else {
+                    yv[i] = ycbcr_luma(&im, cx, cy);
+                    cb[i] = ycbcr_chroma(&im, 1, is420 ? cx/2 : cx, is420 ? cy/2 : cy);
+                    cr[i] = ycbcr_chroma(&im, 2, is420 ? cx/2 : cx, is420 ? cy/2 : cy);
+                }
+            }
+            ycbcr_to_chroma(&im, yv, cb, cr, &chroma_a->img[cy * chroma_a->width + cx0], &chroma_b->img[cy * chroma_b->width + cx0], n);
         }
-        for (int s = 0; s < img->chan[ch].num_scales; s++) {
-            dssim_preprocess_channel(&img->chan[ch].scales[s], tmp);
+        pyramid_push_row(&img->chan[1], 0, cy);
+        pyramid_push_row(&img->chan[2], 0, cy);
+    }
+
+    return img;
+}
+
+/*
+ is_gray images have 1 channel, and are compared as if they had chroma of gray.
+ Built-in color types have convert_subsampled, which is used instead of cb when chroma is subsampled.
+ */
+static dssim_image *dssim_create_image_channels(dssim_attr *attr, const int num_channels, const bool is_gray, const int width, const int height, dssim_rows_callback cb, convert_subsampled_fn *convert_subsampled, void *callback_user_data)
+{
+    const bool subsample_chroma = (width >= 8 && height >= 8) ? attr->subsample_chroma : false;
+
+    dssim_image *img = dssim_alloc_image(attr, num_channels, width, height, subsample_chroma, false, is_gray, NULL, 0);
+
+    // All scales are made during conversion
+    if (subsample_chroma && img->num_channels > 1) {
+        if (convert_subsampled) {
+            convert_subsampled(img, callback_user_data);
+        } else {
+            convert_image_subsampled(img, cb, callback_user_data);
         }
+    } else {
+        convert_image_simple(img, cb, callback_user_data);
     }
 
     return img;
 }
 
-static void dssim_preprocess_channel(dssim_chan *chan, dssim_px_t *tmp)
+/*
+ Images are created without blurs. Each scale is blurred by the first comparison that uses it,
+ so scales that are never compared (e.g. the modified image has fewer) cost no time or memory for mu and img_sq_blur.
+ */
+static void dssim_preprocess_channel_once(const dssim_attr *attr, dssim_chan *chan, dssim_px_t *tmp)
+{
+    if (!chan->mu && !chan->mu_u16 && !chan->mu_f16) {
+        dssim_preprocess_channel(attr, chan, tmp);
+    }
+}
+
+/*
+ The original is const to callers, who may compare it in several threads at once, so its blurs are made under its lock.
+ */
+static void dssim_preprocess_original_once(const dssim_attr *attr, const dssim_image *original_image, dssim_chan *chan, dssim_px_t *tmp)
+{
+    pthread_mutex_t *const lock = (pthread_mutex_t *)&original_image->blur_lock;
+    pthread_mutex_lock(lock);
+    dssim_preprocess_channel_once(attr, chan, tmp);
+    pthread_mutex_unlock(lock);
+}
+
+static void dssim_preprocess_channel(const dssim_attr *attr, dssim_chan *chan, dssim_px_t *tmp)
 {
     assert(chan);
     assert(tmp);
-    assert(chan->img);
+    assert(chan->img || chan->img_u8);
     assert(!chan->mu);
     assert(!chan->img_sq_blur);
     const int width = chan->width;
     const int height = chan->height;
 
-    if (chan->is_chroma) {
-        blur(chan->img, tmp, chan->img, width, height);
+    if (chan->img_u8) {
+        assert(blur_band_tmp_size(width) * sizeof(dssim_px_t) >= FIXED_BLUR_ROWS * width * sizeof(uint32_t));
+        const int threads = dssim_num_threads(attr);
+        chan->mu_u16 = malloc(width * height * sizeof(chan->mu_u16[0]));
+        chan->img_sq_blur_u32 = malloc(width * height * sizeof(chan->img_sq_blur_u32[0]));
+        fixed_blur_u16(threads, chan->img_u8, chan->mu_u16, tmp, width, height);
+        fixed_blur_u32(threads, chan->img_u8, chan->img_u8, chan->img_sq_blur_u32, tmp, width, height);
+        return;
     }
 
-    chan->mu = malloc(width * height * sizeof(chan->mu[0]));
-    blur(chan->img, tmp, chan->mu, width, height);
+    // Chroma is blurred in place, and img is rounded to half in place, so they can't use the caller's plane
+    if (chan->img_borrowed && (chan->is_chroma || chan->half_storage)) {
+        dssim_px_t *const copy = malloc(width * height * sizeof(copy[0]));
+        for(int y = 0; y < height; y++) {
+            memcpy(&copy[y * width], &chan->img[y * chan->stride], width * sizeof(copy[0]));
+        }
+        chan->img = copy;
+        chan->stride = width;
+        chan->img_borrowed = false;
+    }
 
+    chan->mu = malloc(width * height * sizeof(chan->mu[0]));
     chan->img_sq_blur = malloc(width * height * sizeof(chan->img_sq_blur[0]));
-    for(int i=0; i < width*height; i++) {
-        chan->img_sq_blur[i] = chan->img[i] * chan->img[i];
+    if (chan->half_storage) {
+        chan->img_f16 = malloc(width * height * sizeof(chan->img_f16[0]));
+    }
+    blur_chan(attr, chan, tmp);
+
+    if (chan->half_storage) {
+        dssim_chan_to_half(chan);
+    }
+}
+
+/*
+ Makes mu and img_sq_blur of img. Chroma is blurred in place first.
+ With img_f16, img is rounded to half precision before mu is made, so that blurs describe the img that is kept.
+ */
+static void blur_chan(const dssim_attr *attr, dssim_chan *chan, dssim_px_t *tmp)
+{
+    const int width = chan->width;
+    const int height = chan->height;
+
+#ifndef USE_COCOA
+    if (chan->is_chroma && chan->blur.sigma == 0) {
+        box_blur_chained(dssim_num_threads(attr), chan->img, chan->img_f16, chan->mu, chan->img_sq_blur, tmp, width, height);
+        return;
+    }
+#endif
+
+    if (chan->is_chroma) {
+        blur_planes(attr, &chan->blur, 1, blur_input_plane, chan->img, (dssim_px_t *[]){chan->img}, tmp, width, height);
+    }
+
+    if (chan->img_f16) {
+        float_to_half_px(chan->img, chan->img_f16, width * height);
+        half_to_float_px(chan->img_f16, chan->img, width * height);
+    }
+
+    // mu and img_sq_blur are made in one pass over img
+    blur_planes(attr, &chan->blur, 2, blur_input_img_and_sq, chan, (dssim_px_t *[]){chan->mu, chan->img_sq_blur}, tmp, width, height);
+}
+
+/*
+ Replaces mu and img_sq_blur with half-precision planes, after img_f16 has been made.
+ The variance is stored instead of img_sq_blur, because most of its precision would be lost when mu^2 is subtracted later.
+ */
+static void dssim_chan_to_half(dssim_chan *chan)
+{
+    const int size = chan->width * chan->height;
+
+    for(int i=0; i < size; i++) {
+        chan->img_sq_blur[i] -= chan->mu[i] * chan->mu[i];
     }
-    blur(chan->img_sq_blur, tmp, chan->img_sq_blur, width, height);
+
+    chan->mu_f16 = malloc(size * sizeof(chan->mu_f16[0]));
+    chan->sigma_sq_f16 = malloc(size * sizeof(chan->sigma_sq_f16[0]));
+    float_to_half_px(chan->mu, chan->mu_f16, size);
+    float_to_half_px(chan->img_sq_blur, chan->sigma_sq_f16, size);
+
+    free(chan->img); chan->img = NULL;
+    free(chan->mu); chan->mu = NULL;
+    free(chan->img_sq_blur); chan->img_sq_blur = NULL;
 }
 
-static dssim_px_t *get_img1_img2_blur(const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp)
+static dssim_px_t *get_img1_img2_blur(const dssim_attr *attr, const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp)
 {
     const int width = original->width;
     const int height = original->height;
 
-    dssim_px_t *restrict img1 = original->img;
-    dssim_px_t *restrict img2 = modified->img; modified->img = NULL; // img2 is turned in-place into blur(img1*img2)
+    assert(original->img);
+    assert(modified->img);
 
-    assert(img1);
-    assert(img2);
+    // img2 is turned in-place into blur(img1*img2), unless it's the caller's
+    dssim_px_t *img1_img2_blur = modified->img_borrowed ? malloc(width * height * sizeof(img1_img2_blur[0])) : modified->img;
 
-    for (int j = 0; j < width*height; j++) {
-        img2[j] *= img1[j];
-    }
+    blur_planes(attr, &original->blur, 1, blur_input_product, (const dssim_chan *[]){original, modified}, (dssim_px_t *[]){img1_img2_blur}, tmp, width, height);
 
-    blur(img2, tmp, img2, width, height);
+    modified->img = NULL;
+    modified->img_borrowed = false;
+    return img1_img2_blur;
+}
 
-    return img2;
+/*
+ * Rows are summed separately and then in order, so that the total doesn't depend on how rows were split between threads
+ */
+static double sum_rows(const double *row_sums, const int height)
+{
+    double sum = 0;
+    for (int y = 0; y < height; y++) {
+        sum += row_sums[y];
+    }
+    return sum;
 }
 
 static double to_dssim(double ssim) {
@@ -669,7 +2672,80 @@ static double to_dssim(double ssim) {
     return 1.0 / MIN(1.0, ssim) - 1.0;
 }
 
-static double dssim_compare_channel(const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map);
+static double dssim_compare_channel(const dssim_attr *attr, const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map);
+
+/* A and b of gray pixels (see rgb_to_lab()) */
+static const dssim_px_t gray_chroma[MAX_CHANS] = {0, 86.2f/ 220.0f, 107.9f/ 220.0f};
+
+/*
+ Float channel of the given size with all pixels set to value, as if it was blurred
+ */
+static dssim_chan constant_chan(const dssim_chan *size, const dssim_px_t value)
+{
+    const int n = size->width * size->height;
+    dssim_chan c = {
+        .width = size->width,
+        .height = size->height,
+        .stride = size->width,
+        .is_chroma = size->is_chroma,
+        .blur = size->blur,
+        .img = malloc(n * sizeof(c.img[0])),
+        .mu = malloc(n * sizeof(c.mu[0])),
+        .img_sq_blur = malloc(n * sizeof(c.img_sq_blur[0])),
+    };
+    for(int i=0; i < n; i++) {
+        c.img[i] = value;
+        c.mu[i] = value;
+        c.img_sq_blur[i] = value * value;
+    }
+    return c;
+}
+
+/*
+ dssim_compare_channel() for a chroma channel that isn't stored in one or both images, because they're gray
+ */
+static double dssim_compare_gray_chroma(const dssim_attr *attr, const dssim_px_t value, const dssim_chan *original, const bool original_is_gray, dssim_chan *modified, const bool modified_is_gray, dssim_px_t *tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map)
+{
+    if (original->width != modified->width || original->height != modified->height) {
+        return 0;
+    }
+
+    if (original_is_gray && modified_is_gray) {
+        // Both are constant and equal
+        const int n = original->width * original->height;
+        dssim_px_t *ssimmap = save_ssim_map ? malloc(n * sizeof(ssimmap[0])) : NULL;
+        for(int i=0; ssimmap && i < n; i++) {
+            ssimmap[i] = 1.0;
+        }
+        *ssim_map_out = (dssim_ssim_map){
+            .width = original->width,
+            .height = original->height,
+            .dssim = 0,
+            .data = ssimmap,
+        };
+        return 1.0;
+    }
+
+    if (modified_is_gray) {
+        dssim_chan modified_chroma = constant_chan(modified, value);
+        const double ssim = dssim_compare_channel(attr, original, &modified_chroma, tmp, ssim_map_out, save_ssim_map);
+        dealloc_chan(&modified_chroma);
+        return ssim;
+    }
+
+    dssim_chan original_chroma = constant_chan(original, value);
+    const double ssim = dssim_compare_channel(attr, &original_chroma, modified, tmp, ssim_map_out, save_ssim_map);
+    dealloc_chan(&original_chroma);
+    return ssim;
+}
+
+/*
+ Gray images are compared as if they had all 3 channels
+ */
+static int compared_channels(const dssim_image *img)
+{
+    return img->is_gray ? MAX_CHANS : img->num_channels;
+}
 
 /**
  Algorithm based on Rabah Mehdi's C++ implementation
@@ -684,23 +2760,24 @@ double dssim_compare(dssim_attr *attr, const dssim_image *restrict original_imag
     assert(original_image);
     assert(modified_image);
 
-    const int channels = MIN(original_image->num_channels, modified_image->num_channels);
+    const int channels = MIN(compared_channels(original_image), compared_channels(modified_image));
     assert(channels > 0);
 
-    dssim_px_t *tmp = dssim_get_tmp(attr, original_image->chan[0].scales[0].width * original_image->chan[0].scales[0].height * sizeof(tmp[0]));
+    dssim_px_t *tmp = dssim_get_tmp(attr, blur_tmp_size(attr, original_image->chan[0].scales[0].width, original_image->chan[0].scales[0].height));
     assert(tmp);
 
     double ssim_sum = 0;
     double weight_sum = 0;
     for (int ch = 0; ch < channels; ch++) {
 
-        const dssim_image_chan *original_scales = &original_image->chan[ch];
+        // Blurs of the original are made on first use, and kept for later comparisons (so it's const only to callers)
+        dssim_image_chan *original_scales = (dssim_image_chan *)&original_image->chan[ch];
         dssim_image_chan *modified_scales = &modified_image->chan[ch];
 
         int num_scales = MIN(original_scales->num_scales, modified_scales->num_scales);
 
         for(int n=0; n < num_scales; n++) {
-            const dssim_chan *original = &original_scales->scales[n];
+            dssim_chan *original = &original_scales->scales[n];
             dssim_chan *modified = &modified_scales->scales[n];
 
             const double weight = (original->is_chroma ? attr->color_weight : 1.0) * attr->scale_weights[n];
@@ -712,20 +2789,251 @@ double dssim_compare(dssim_attr *attr, const dssim_image *restrict original_imag
             }
             assert(original);
             assert(modified);
-            ssim_sum += weight * dssim_compare_channel(original, modified, tmp, &attr->ssim_maps[ch].scales[n], save_maps);
+            const bool original_is_gray = ch >= original_image->num_channels, modified_is_gray = ch >= modified_image->num_channels;
+            if (original->width == modified->width && original->height == modified->height) {
+                if (!original_is_gray) {
+                    dssim_preprocess_original_once(attr, original_image, original, tmp);
+                }
+                if (!modified_is_gray) {
+                    dssim_preprocess_channel_once(attr, modified, tmp);
+                }
+            }
+            if (original_is_gray || modified_is_gray) {
+                ssim_sum += weight * dssim_compare_gray_chroma(attr, gray_chroma[ch], original, original_is_gray, modified, modified_is_gray, tmp, &attr->ssim_maps[ch].scales[n], save_maps);
+            } else {
+                ssim_sum += weight * dssim_compare_channel(attr, original, modified, tmp, &attr->ssim_maps[ch].scales[n], save_maps);
+            }
             weight_sum += weight;
         }
     }
 
+    if (!weight_sum) { // images less than 16 pixels wide or tall have no scales to compare
+        return 0;
+    }
     return to_dssim(ssim_sum / weight_sum);
 }
 
-static double dssim_compare_channel(const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map)
+/*
+ Float copy of a fixed-point channel
+ */
+static dssim_chan widen_fixed_chan(const dssim_chan *chan)
+{
+    const int size = chan->width * chan->height;
+    dssim_chan f = {
+        .width = chan->width,
+        .height = chan->height,
+        .stride = chan->width,
+        .is_chroma = chan->is_chroma,
+        .img = malloc(size * sizeof(f.img[0])),
+        .mu = malloc(size * sizeof(f.mu[0])),
+        .img_sq_blur = malloc(size * sizeof(f.img_sq_blur[0])),
+    };
+
+    const dssim_px_t img_scale = 1.0 / 255.0;
+    const dssim_px_t mu_scale = 1.0 / (FIXED_BLUR_WEIGHT * 255.0);
+    const dssim_px_t sq_scale = 1.0 / (FIXED_BLUR_WEIGHT * 255.0 * 255.0);
+    for(int i=0; i < size; i++) {
+        f.img[i] = chan->img_u8[i] * img_scale;
+        f.mu[i] = chan->mu_u16[i] * mu_scale;
+        f.img_sq_blur[i] = chan->img_sq_blur_u32[i] * sq_scale;
+    }
+    return f;
+}
+
+/*
+ dssim_compare_channel() for two fixed-point channels.
+ All terms of SSIM are exact, scaled by (81*255)^2
+ */
+static double dssim_compare_channel_fixed(const dssim_attr *attr, const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map)
+{
+    const int width = original->width;
+    const int height = original->height;
+
+    const uint16_t *restrict mu1 = original->mu_u16;
+    const uint16_t *restrict mu2 = modified->mu_u16;
+    const uint32_t *restrict img1_sq_blur = original->img_sq_blur_u32;
+    const uint32_t *restrict img2_sq_blur = modified->img_sq_blur_u32;
+    uint32_t *restrict img1_img2_blur = malloc(width * height * sizeof(img1_img2_blur[0]));
+    fixed_blur_u32(dssim_num_threads(attr), original->img_u8, modified->img_u8, img1_img2_blur, tmp, width, height);
+
+    const double scale = (FIXED_BLUR_WEIGHT * 255.0) * (FIXED_BLUR_WEIGHT * 255.0);
+    const double c1 = 0.01 * 0.01 * scale, c2 = 0.03 * 0.03 * scale;
+    double *const row_sums = malloc(height * sizeof(row_sums[0]));
+
+    dssim_px_t *const ssimmap = save_ssim_map ? malloc(width * height * sizeof(ssimmap[0])) : NULL;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(dssim_num_threads(attr)) schedule(static)
+#endif
+    for (int y = 0; y < height; y++) {
+      double row_sum = 0;
+      for (int offset = y*width; offset < (y+1)*width; offset++) {
+        // These are integers below 2^32, so doubles hold them exactly
+        const double mu1_sq = (double)mu1[offset]*mu1[offset];
+        const double mu2_sq = (double)mu2[offset]*mu2[offset];
+        const double mu1_mu2 = (double)mu1[offset]*mu2[offset];
+        const double sigma1_sq = FIXED_BLUR_WEIGHT * (double)img1_sq_blur[offset] - mu1_sq;
+        const double sigma2_sq = FIXED_BLUR_WEIGHT * (double)img2_sq_blur[offset] - mu2_sq;
+        const double sigma12 = FIXED_BLUR_WEIGHT * (double)img1_img2_blur[offset] - mu1_mu2;
+
+        const double ssim = (2.0 * mu1_mu2 + c1) * (2.0 * sigma12 + c2)
+                      /
+                      ((mu1_sq + mu2_sq + c1) * (sigma1_sq + sigma2_sq + c2));
+
+        row_sum += ssim;
+
+        if (ssimmap) {
+            ssimmap[offset] = ssim;
+        }
+      }
+      row_sums[y] = row_sum;
+    }
+
+    const double ssim_sum = sum_rows(row_sums, height);
+    free(row_sums);
+
+    *ssim_map_out = (dssim_ssim_map){
+        .width = width,
+        .height = height,
+        .dssim = to_dssim(ssim_sum / (width * height)),
+        .data = ssimmap,
+    };
+
+    free(img1_img2_blur);
+    free(modified->img_u8); modified->img_u8 = NULL;
+    free(modified->mu_u16); modified->mu_u16 = NULL;
+    free(modified->img_sq_blur_u32); modified->img_sq_blur_u32 = NULL;
+
+    return ssim_sum / (width * height);
+}
+
+/*
+ Pixels [offset, offset+n) of the variance of a channel stored either as float or as half
+ */
+static const dssim_px_t *load_sigma_sq(const dssim_chan *chan, const dssim_px_t *mu, const int offset, const int n, dssim_px_t *restrict buf)
+{
+    if (chan->sigma_sq_f16) {
+        half_to_float_px(chan->sigma_sq_f16 + offset, buf, n);
+    } else {
+        for(int i=0; i < n; i++) {
+            buf[i] = chan->img_sq_blur[offset + i] - mu[i] * mu[i];
+        }
+    }
+    return buf;
+}
+
+/*
+ dssim_compare_channel() when either channel is stored as half (see dssim_set_half_storage).
+
+ Rounding mu to half would make blur(img1*img2) - mu1*mu2 useless, so the covariance is computed from the variances
+ and the blurred squared difference instead: sigma12 = (sigma1^2 + sigma2^2 - (blur((img1-img2)^2) - (mu1-mu2)^2)) / 2.
+ Errors of this form shrink as images become more similar, and identical images still have SSIM of exactly 1.
+ */
+static double dssim_compare_channel_half(const dssim_attr *attr, const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map)
+{
+    const int width = original->width;
+    const int height = original->height;
+
+    assert(original->mu || original->mu_f16);
+    assert(modified->mu || modified->mu_f16);
+
+    const diff_input input = {
+        .img = {original->img, modified->img},
+        .img_f16 = {original->img_f16, modified->img_f16},
+        .stride = {original->stride, modified->stride},
+    };
+    dssim_px_t *restrict diff_sq_blur = malloc(width * height * sizeof(diff_sq_blur[0]));
+    blur_planes(attr, &original->blur, 1, blur_input_diff_sq, &input, (dssim_px_t *[]){diff_sq_blur}, tmp, width, height);
+
+    const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+    double *const row_sums = malloc(height * sizeof(row_sums[0]));
+
+    dssim_px_t *const ssimmap = save_ssim_map ? malloc(width * height * sizeof(ssimmap[0])) : NULL;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(dssim_num_threads(attr)) schedule(static)
+#endif
+    for (int y = 0; y < height; y++) {
+      // tmp is free after the blur, and has room for 4 rows per thread
+      dssim_px_t *const rows_tmp = tmp + omp_get_thread_num() * blur_band_tmp_size(width);
+      const dssim_px_t *restrict mu1 = load_pixels(original->mu, original->mu_f16, y*width, width, rows_tmp);
+      const dssim_px_t *restrict mu2 = load_pixels(modified->mu, modified->mu_f16, y*width, width, rows_tmp + width);
+      const dssim_px_t *restrict sigma1_sq = load_sigma_sq(original, mu1, y*width, width, rows_tmp + 2*width);
+      const dssim_px_t *restrict sigma2_sq = load_sigma_sq(modified, mu2, y*width, width, rows_tmp + 3*width);
+      const dssim_px_t *restrict diff_sq = diff_sq_blur + y*width;
+
+      double row_sum = 0;
+      for (int x = 0; x < width; x++) {
+        const double mu1_sq = mu1[x]*mu1[x];
+        const double mu2_sq = mu2[x]*mu2[x];
+        const double mu1_mu2 = mu1[x]*mu2[x];
+        const double mu_diff = mu1[x] - mu2[x];
+        const double sigma_diff_sq = diff_sq[x] - mu_diff * mu_diff;
+        const double sigma12 = 0.5 * (sigma1_sq[x] + sigma2_sq[x] - sigma_diff_sq);
+
+        const double ssim = (2.0 * mu1_mu2 + c1) * (2.0 * sigma12 + c2)
+                      /
+                      ((mu1_sq + mu2_sq + c1) * (sigma1_sq[x] + sigma2_sq[x] + c2));
+
+        row_sum += ssim;
+
+        if (ssimmap) {
+            ssimmap[x + y*width] = ssim;
+        }
+      }
+      row_sums[y] = row_sum;
+    }
+
+    const double ssim_sum = sum_rows(row_sums, height);
+    free(row_sums);
+
+    *ssim_map_out = (dssim_ssim_map){
+        .width = width,
+        .height = height,
+        .dssim = to_dssim(ssim_sum / (width * height)),
+        .data = ssimmap,
+    };
+
+    free(diff_sq_blur);
+    release_img(modified);
+    free(modified->mu); modified->mu = NULL;
+    free(modified->img_sq_blur); modified->img_sq_blur = NULL;
+    free(modified->img_f16); modified->img_f16 = NULL;
+    free(modified->mu_f16); modified->mu_f16 = NULL;
+    free(modified->sigma_sq_f16); modified->sigma_sq_f16 = NULL;
+
+    return ssim_sum / (width * height);
+}
+
+static double dssim_compare_channel(const dssim_attr *attr, const dssim_chan *restrict original, dssim_chan *restrict modified, dssim_px_t *restrict tmp, dssim_ssim_map *ssim_map_out, bool save_ssim_map)
 {
     if (original->width != modified->width || original->height != modified->height) {
         return 0;
     }
 
+    if (original->img_u8 || modified->img_u8) {
+        if (original->img_u8 && modified->img_u8) {
+            return dssim_compare_channel_fixed(attr, original, modified, tmp, ssim_map_out, save_ssim_map);
+        }
+
+        // Compared with a float image
+        if (modified->img_u8) {
+            dssim_chan modified_float = widen_fixed_chan(modified);
+            dealloc_chan(modified);
+            *modified = modified_float;
+        }
+        if (original->img_u8) {
+            dssim_chan original_float = widen_fixed_chan(original);
+            const double ssim = dssim_compare_channel(attr, &original_float, modified, tmp, ssim_map_out, save_ssim_map);
+            dealloc_chan(&original_float);
+            return ssim;
+        }
+    }
+
+    if (original->img_f16 || modified->img_f16) {
+        return dssim_compare_channel_half(attr, original, modified, tmp, ssim_map_out, save_ssim_map);
+    }
+
     const int width = original->width;
     const int height = original->height;
 
@@ -733,7 +3041,7 @@ static double dssim_compare_channel(const dssim_chan *restrict original, dssim_c
     dssim_px_t *const mu2 = modified->mu;
     const dssim_px_t *restrict img1_sq_blur = original->img_sq_blur;
     const dssim_px_t *restrict img2_sq_blur = modified->img_sq_blur;
-    dssim_px_t *restrict img1_img2_blur = get_img1_img2_blur(original, modified, tmp);
+    dssim_px_t *restrict img1_img2_blur = get_img1_img2_blur(attr, original, modified, tmp);
 
     assert(mu1);
     assert(mu2);
@@ -741,11 +3049,16 @@ static double dssim_compare_channel(const dssim_chan *restrict original, dssim_c
     assert(img2_sq_blur);
 
     const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
-    double ssim_sum = 0;
+    double *const row_sums = malloc(height * sizeof(row_sums[0]));
 
     dssim_px_t *const ssimmap = save_ssim_map ? mu2 : NULL;
 
-    for (int offset = 0; offset < width * height; offset++) {
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(dssim_num_threads(attr)) schedule(static)
+#endif
+    for (int y = 0; y < height; y++) {
+      double row_sum = 0;
+      for (int offset = y*width; offset < (y+1)*width; offset++) {
         const double mu1_sq = mu1[offset]*mu1[offset];
         const double mu2_sq = mu2[offset]*mu2[offset];
         const double mu1_mu2 = mu1[offset]*mu2[offset];
@@ -757,13 +3070,18 @@ static double dssim_compare_channel(const dssim_chan *restrict original, dssim_c
                       /
                       ((mu1_sq + mu2_sq + c1) * (sigma1_sq + sigma2_sq + c2));
 
-        ssim_sum += ssim;
+        row_sum += ssim;
 
         if (ssimmap) {
             ssimmap[offset] = ssim;
         }
+      }
+      row_sums[y] = row_sum;
     }
 
+    const double ssim_sum = sum_rows(row_sums, height);
+    free(row_sums);
+
     if (!save_ssim_map) { // reuses mu2 memory
         free(modified->mu);
     }
@@ -17,6 +17,8 @@
  * If not, see <http://www.gnu.org/licenses/agpl.txt>.
  */
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -36,6 +38,13 @@ typedef enum dssim_colortype {
     DSSIM_LUMA = 4, // 1 byte per pixel, used as-is
     DSSIM_LAB  = 5, // 3 bytes per pixel, used as-is
     DSSIM_RGBA_TO_GRAY = 3 | 32, // 4 bytes per pixel, but only luma is used
+    DSSIM_GRAY_TO_RGB = 1 | 64, // 1 byte per pixel, gamma applied, compared like DSSIM_RGB with R==G==B (DSSIM_GRAY only compares luma)
+    DSSIM_YCBCR420 = 6, // planar Y'CbCr with chroma at half width and height, 8-bit limited range, BT.601 (see dssim_create_image_ycbcr)
+    DSSIM_YCBCR444 = 7, // planar Y'CbCr with chroma at full resolution, otherwise as DSSIM_YCBCR420
+    DSSIM_LINEAR_RGBA_F32 = 8, // 4 floats per pixel, linear light with premultiplied alpha, clamped to 0-1 (NaN as 0), gamma ignored, rows aligned to 4 bytes
+    DSSIM_LINEAR_RGBA_F16 = 9, // 4 IEEE half floats (native-endian uint16_t) per pixel, rows aligned to 2 bytes, otherwise as DSSIM_LINEAR_RGBA_F32
+    DSSIM_YCBCR_BT709 = 128, // flag for DSSIM_YCBCR420/444: BT.709 matrix instead of BT.601
+    DSSIM_YCBCR_10BIT = 256, // flag for DSSIM_YCBCR420/444: 10-bit samples (64-940 luma, 64-960 chroma) in native-endian uint16_t
 } dssim_colortype;
 
 typedef struct {
@@ -56,6 +65,49 @@ static const double dssim_srgb_gamma = -47571492;
 */
 void dssim_set_scales(dssim_attr *attr, const int num, const double *weights);
 
+/*
+    Standard deviation of the Gaussian window used by SSIM, e.g. 1.5 to match the 11x11 window of the reference implementation.
+    0 (default) uses the built-in approximation (two 3x3 box blurs, sigma of about 1.15). Values below 0.5 are treated as 0.
+    Any sigma takes about the same time, since the Gaussian is computed recursively.
+    Images keep the sigma that was set when they were created, so images compared with each other should be created with the same sigma.
+*/
+void dssim_set_blur_sigma(dssim_attr *attr, double sigma);
+
+/*
+    Non-zero enables integer arithmetic for DSSIM_LUMA and DSSIM_GRAY images (off by default). The full-size scale is kept as 8-bit pixels,
+    blurred with exact 16-bit and 32-bit sums, which is faster and needs less memory. Only used with the default blur (sigma 0).
+    SSIM of the full-size scale is then exact, while the float path rounds variances (E[x^2]-E[x]^2), most in bright, flat areas.
+    For nearly identical images that rounding can exceed the score itself (e.g. 3.4e-4 instead of 9.4e-6 for a 16x16 image of level 230
+    shifted by one), so the two paths don't agree within any relative bound. DSSIM_GRAY luma is rounded to 8 bits first, which changes
+    the image, most where many dark levels round to the same luma: scores can be several times those of the float path.
+    Set before creating any images.
+*/
+void dssim_set_fixed_point(dssim_attr *attr, int enabled);
+
+/*
+    Non-zero keeps preprocessed planes of float images in IEEE half precision (off by default), converted with F16C when the CPU has it.
+    This halves their memory, e.g. a kept RGBA image with all scales needs about 12 instead of 24 bytes per pixel.
+    Identical images still have DSSIM of 0, but other results differ from float storage by up to about 4% (relative) or 3e-4 (absolute).
+    Applies to images created after it's set, and images with and without it can be compared with each other.
+*/
+void dssim_set_half_storage(dssim_attr *attr, int enabled);
+
+/*
+    Non-zero converts 8-bit RGB and opaque RGBA pixels to Lab by tetrahedral interpolation in a 33x33x33 table (424KB),
+    which is built once per gamma value and kept in the attr. Translucent pixels are converted exactly.
+    Over all 8-bit sRGB colors the largest error is ΔE 0.67 (mean 0.02), in dark colors where the cube root bends most.
+    Conversion is about 5 times faster on CPUs without AVX2 and FMA. On CPUs with them the vectorized exact path is 2-3 times faster
+    than the table, so the setting is ignored there.
+    Applies to images created after it's set.
+*/
+void dssim_set_color_lut(dssim_attr *attr, int enabled);
+
+/*
+    Maximum number of threads used for blurring and comparing (0 = default, which is set by OpenMP, usually the number of CPUs).
+    Results are identical for any number of threads. Has no effect if DSSIM is compiled without OpenMP.
+*/
+void dssim_set_threads(dssim_attr *attr, int num_threads);
+
 /*
     Maximum number scales for which bitmaps with per-pixel SSIM values are saved (0 = no saving).
     Set before comparison.
@@ -81,13 +133,57 @@ void dssim_set_color_handling(dssim_attr *, int subsampling, double color_weight
  */
 typedef void dssim_row_callback(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int width, void *user_data);
 
+/*
+  Write `num_rows` rows (from index `y`) of `width` pixels. Row `y + i` of each channel starts at channels[c] + i * stride.
+  Channels are as in dssim_row_callback. The number of rows is chosen by the library to fit in cache (the last batch may have fewer).
+ */
+typedef void dssim_rows_callback(dssim_px_t *const restrict channels[], const int num_channels, const int y, const int num_rows, const int width, const size_t stride, void *user_data);
+
+/*
+    DSSIM_RGB and opaque DSSIM_RGBA images in which all pixels have R==G==B are stored as luma only,
+    and compared as if they had the chroma of gray (the result is the same, apart from float rounding).
+ */
 dssim_image *dssim_create_image(dssim_attr *, unsigned char *const *const row_pointers, dssim_colortype color_type, const int width, const int height, const double gamma);
+/*
+    Planar Y'CbCr image, e.g. a decoded video frame. color_type is DSSIM_YCBCR420 or DSSIM_YCBCR444, optionally with DSSIM_YCBCR_BT709 and DSSIM_YCBCR_10BIT.
+    planes are Y', Cb and Cr, and strides are their row lengths in bytes. Gamma is applied as in dssim_create_image (e.g. 0.45 for BT.709 video).
+    Luma is mapped straight to lightness, which is exact for neutral colors, so results differ slightly from the same frame converted to RGB.
+    Chroma of 4:2:0 is converted at its own resolution and isn't subsampled again.
+ */
+dssim_image *dssim_create_image_ycbcr(dssim_attr *, const void *const planes[3], const size_t strides[3], dssim_colortype color_type, const int width, const int height, const double gamma);
+/*
+    Same as dssim_create_image(), but row y starts at base + y * stride (in bytes), so no array of row pointers is needed.
+ */
+dssim_image *dssim_create_image_strided(dssim_attr *, const unsigned char *base, const size_t stride, dssim_colortype color_type, const int width, const int height, const double gamma);
+/*
+    Image with 1 byte per pixel, which is an index into the palette (colors past num_palette are black). Gamma is applied.
+    The palette is converted to Lab once, so this is much faster than expanding the image to DSSIM_RGBA,
+    and gives the same result (apart from float rounding). Translucent colors are composited on the same checkerboard.
+ */
+dssim_image *dssim_create_image_indexed(dssim_attr *, unsigned char *const *const row_pointers, const dssim_rgba palette[], const int num_palette, const int width, const int height, const double gamma);
 dssim_image *dssim_create_image_float_callback(dssim_attr *, const int num_channels, const int width, const int height, dssim_row_callback cb, void *callback_user_data);
+/*
+    Same as dssim_create_image_float_callback(), but the callback writes many rows at a time.
+ */
+dssim_image *dssim_create_image_float_callback_rows(dssim_attr *, const int num_channels, const int width, const int height, dssim_rows_callback cb, void *callback_user_data);
+/*
+    Image made from the caller's planes of floats: luma if num_channels == 1, or L, a, b (as written by dssim_row_callback) if it's 3.
+    Row y of plane c starts at planes[c] + y * stride (stride is in pixels, not bytes).
+
+    The planes are used as the full-size scale without copying, so they must stay valid and unchanged until the image
+    is freed with dssim_dealloc_image() (or, for a modified image, until dssim_compare() returns). DSSIM never writes to them or frees them.
+    DSSIM allocates only blurs and smaller scales, and copies of planes that would be changed in place during comparison:
+    chroma planes (which are subsampled when the image is created, if subsampling is enabled) and all planes with half storage.
+ */
+dssim_image *dssim_create_image_float_planes(dssim_attr *, const int num_channels, const dssim_px_t *const planes[], const size_t stride, const int width, const int height);
 void dssim_dealloc_image(dssim_image *);
 
 /*
 Returns DSSIM between two images.
 Original image can be reused. Modified image is destroyed (but still needs to be freed using dssim_dealloc_image).
+All scales of an image are converted and downsampled when it's created. Only blurs are lazy: each scale is blurred by the first comparison
+that uses it, so scales that are never compared don't get blurred planes, and the original keeps its blurs for later comparisons.
+The same original can be compared in several threads at once, as long as each thread uses its own attr.
  */
 double dssim_compare(dssim_attr *, const dssim_image *restrict original, dssim_image *restrict modified);
 #ifdef __cplusplus
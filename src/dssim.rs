@@ -1,7 +1,9 @@
 extern crate libc;
 
 pub use ffi::dssim_ssim_map;
+pub use ffi::dssim_rgba;
 pub use ffi::dssim_colortype::*;
+pub use ffi::{DSSIM_YCBCR_BT709, DSSIM_YCBCR_10BIT};
 
 use libc::{c_int, c_uint};
 mod ffi;
@@ -43,6 +45,30 @@ impl Dssim {
         }
     }
 
+    pub fn set_fixed_point(&mut self, enabled: bool) {
+        unsafe {
+            ffi::dssim_set_fixed_point(self.handle, enabled as c_int);
+        }
+    }
+
+    pub fn set_half_storage(&mut self, enabled: bool) {
+        unsafe {
+            ffi::dssim_set_half_storage(self.handle, enabled as c_int);
+        }
+    }
+
+    pub fn set_color_lut(&mut self, enabled: bool) {
+        unsafe {
+            ffi::dssim_set_color_lut(self.handle, enabled as c_int);
+        }
+    }
+
+    pub fn set_threads(&mut self, num_threads: usize) {
+        unsafe {
+            ffi::dssim_set_threads(self.handle, num_threads as c_int);
+        }
+    }
+
     pub fn set_save_ssim_maps(&mut self, num_scales: u8, num_channels: u8) {
         unsafe {
             ffi::dssim_set_save_ssim_maps(self.handle, num_scales as c_uint, num_channels as c_uint);
@@ -68,14 +94,95 @@ impl Dssim {
             std::slice::from_raw_parts(std::mem::transmute(bitmap.as_ptr()), pixel_size*bitmap.len())
         };
 
-        let row_pointers: Vec<*const u8> = bitmap_bytes.chunks(stride).map(|row| {
-            assert!(row.len() >= stride, "row is {}, bitmap {}, width {}*{}<={}", row.len(), bitmap.len(), width, pixel_size, stride);
+        assert!(bitmap_bytes.len() % stride == 0, "bitmap {}, width {}*{}<={}", bitmap_bytes.len(), width, pixel_size, stride);
+        let height = bitmap_bytes.len() / stride;
+
+        let handle = unsafe {
+            ffi::dssim_create_image_strided(self.handle, bitmap_bytes.as_ptr(), stride, color_type, width as c_int, height as c_int, gamma)
+        };
+
+        if handle.is_null() {
+            None
+        } else {
+            Some(DssimImage::<'img> {
+                handle: handle,
+                _mem_marker: std::marker::PhantomData,
+            })
+        }
+    }
+
+    /// Bitmap has 1-byte indices into the palette
+    pub fn create_image_indexed<'img>(&mut self, bitmap: &'img [u8], palette: &[dssim_rgba], width: usize, stride: usize, gamma: f64) -> Option<DssimImage<'img>> {
+        assert!(stride >= width, "width {}, stride {}", width, stride);
+        assert!(palette.len() <= 256);
+
+        let row_pointers: Vec<*const u8> = bitmap.chunks(stride).map(|row| {
+            assert!(row.len() >= stride, "row is {}, bitmap {}, width {}<={}", row.len(), bitmap.len(), width, stride);
             row.as_ptr()
         }).collect();
 
+        let handle = unsafe {
+            ffi::dssim_create_image_indexed(self.handle, row_pointers.as_ptr(), palette.as_ptr(), palette.len() as c_int, width as c_int, row_pointers.len() as c_int, gamma)
+        };
+
+        if handle.is_null() {
+            None
+        } else {
+            Some(DssimImage::<'img> {
+                handle: handle,
+                _mem_marker: std::marker::PhantomData,
+            })
+        }
+    }
+
+    /// Planes of floats are luma (1 plane), or L, a, b (3 planes), each with `stride` floats per row.
+    /// They're used without copying, and borrowed for the lifetime of the image. DSSIM never writes to them.
+    pub fn create_image_float_planes<'img>(&mut self, planes: &[&'img [f32]], width: usize, stride: usize) -> Option<DssimImage<'img>> {
+        assert!(planes.len() == 1 || planes.len() == 3);
+        assert!(stride >= width, "width {}, stride {}", width, stride);
+        let len = planes[0].len();
+        assert!(len % stride == 0, "plane {}, stride {}", len, stride);
+        let plane_pointers: Vec<*const f32> = planes.iter().map(|plane| {
+            assert_eq!(len, plane.len());
+            plane.as_ptr()
+        }).collect();
 
         let handle = unsafe {
-            ffi::dssim_create_image(self.handle, row_pointers.as_ptr(), color_type, width as c_int, row_pointers.len() as c_int, gamma)
+            ffi::dssim_create_image_float_planes(self.handle, planes.len() as c_int, plane_pointers.as_ptr(), stride, width as c_int, (len / stride) as c_int)
+        };
+
+        if handle.is_null() {
+            None
+        } else {
+            Some(DssimImage::<'img> {
+                handle: handle,
+                _mem_marker: std::marker::PhantomData,
+            })
+        }
+    }
+
+    /// Planes are Y', Cb and Cr of u8 samples, or u16 if flags include DSSIM_YCBCR_10BIT, with strides in bytes.
+    /// color_type is DSSIM_YCBCR420, which has (width+1)/2 by (height+1)/2 chroma samples, or DSSIM_YCBCR444.
+    pub fn create_image_ycbcr<'img, T>(&mut self, planes: [&'img [T]; 3], strides: [usize; 3], color_type: ColorType, flags: c_int, width: usize, gamma: f64) -> Option<DssimImage<'img>> {
+        let sample_size = std::mem::size_of::<T>();
+        assert_eq!(sample_size, if flags & DSSIM_YCBCR_10BIT != 0 { 2 } else { 1 });
+        let luma_bytes = planes[0].len() * sample_size;
+        assert!(strides[0] >= width * sample_size && luma_bytes % strides[0] == 0, "luma {}, width {}*{}<={}", luma_bytes, width, sample_size, strides[0]);
+        let height = luma_bytes / strides[0];
+
+        let (chroma_width, chroma_height) = match color_type {
+            DSSIM_YCBCR420 => ((width + 1) / 2, (height + 1) / 2),
+            DSSIM_YCBCR444 => (width, height),
+            _ => return None,
+        };
+        for c in 1..3 {
+            assert!(strides[c] >= chroma_width * sample_size && planes[c].len() * sample_size >= chroma_height * strides[c],
+                "chroma {}, {}x{} samples, stride {}", planes[c].len() * sample_size, chroma_width, chroma_height, strides[c]);
+        }
+
+        let plane_pointers: Vec<*const libc::c_void> = planes.iter().map(|plane| plane.as_ptr() as *const libc::c_void).collect();
+        let handle = unsafe {
+            ffi::dssim_create_image_ycbcr(self.handle, plane_pointers.as_ptr(), strides.as_ptr(), color_type as c_int | flags, width as c_int, height as c_int, gamma)
         };
 
         if handle.is_null() {
@@ -140,3 +247,538 @@ fn test() {
     assert!(res < 0.000000000000001);
     assert_eq!(res, res);
 }
+
+#[cfg(test)]
+const TEST_WIDTH: usize = 320;
+#[cfg(test)]
+const TEST_HEIGHT: usize = 240;
+
+/// Gradient of TEST_WIDTH x TEST_HEIGHT pixels of `channels` bytes, and a copy of it with noise added
+#[cfg(test)]
+fn gradient_pair(channels: usize) -> (Vec<u8>, Vec<u8>) {
+    let row = TEST_WIDTH * channels;
+    let img1: Vec<u8> = (0..row*TEST_HEIGHT).map(|i| ((i % row) * 3 / channels + (i / row) * 5) as u8).collect();
+    let img2 = img1.iter().enumerate().map(|(i, &px)| px.saturating_add((i * 7919 % 13) as u8)).collect();
+    (img1, img2)
+}
+
+/// DSSIM between images of TEST_WIDTH pixels per row made from the bitmaps
+#[cfg(test)]
+fn compare_bitmaps<T>(d: &mut Dssim, img1: &[T], img2: &[T], color_type: ColorType, bytes_per_pixel: usize) -> f64 {
+    let i1 = d.create_image(img1, color_type, TEST_WIDTH, TEST_WIDTH * bytes_per_pixel, 0.45455).unwrap();
+    let i2 = d.create_image(img2, color_type, TEST_WIDTH, TEST_WIDTH * bytes_per_pixel, 0.45455).unwrap();
+    d.compare(&i1, i2).into()
+}
+
+/// L, a and b (scaled to 0-1 like DSSIM does) of 8-bit RGB with gamma 0.45455, computed in double
+#[cfg(test)]
+fn lab_exact(rgb: [u8; 3]) -> [f64; 3] {
+    let lin: Vec<f64> = rgb.iter().map(|&v| (v as f64 / 255.0).powf(1.0 / 0.45455)).collect();
+    let f = |x: f64| if x > 216.0 / 24389.0 { x.cbrt() - 16.0 / 116.0 } else { (24389.0 / 27.0) / 116.0 * x };
+    let x = f((lin[0] * 0.4124 + lin[1] * 0.3576 + lin[2] * 0.1805) / 0.9505);
+    let y = f(lin[0] * 0.2126 + lin[1] * 0.7152 + lin[2] * 0.0722);
+    let z = f((lin[0] * 0.0193 + lin[1] * 0.1192 + lin[2] * 0.9505) / 1.089);
+    [y * 1.16, (86.2 + 500.0 * (x - y)) / 220.0, (107.9 + 200.0 * (y - z)) / 220.0]
+}
+
+/// DSSIM of one scale of 8-bit luma computed in double, with the blur of the fixed-point path:
+/// two 3-pixel box blurs in each direction, each repeating edge pixels
+#[cfg(test)]
+fn exact_luma_dssim(img1: &[u8], img2: &[u8], width: usize) -> f64 {
+    let height = img1.len() / width;
+    let blur = |plane: &[f64]| -> Vec<f64> {
+        let mut p = plane.to_vec();
+        for &(dx, dy) in &[(1, 0), (1, 0), (0, 1), (0, 1)] {
+            p = (0..width*height).map(|i| {
+                let (x, y) = ((i % width) as isize, (i / width) as isize);
+                let at = |x: isize, y: isize| p[y.max(0).min(height as isize - 1) as usize * width + x.max(0).min(width as isize - 1) as usize];
+                at(x - dx, y - dy) + p[i] + at(x + dx, y + dy)
+            }).collect();
+        }
+        p.iter().map(|v| v / 81.0).collect()
+    };
+    let x: Vec<f64> = img1.iter().map(|&v| v as f64 / 255.0).collect();
+    let y: Vec<f64> = img2.iter().map(|&v| v as f64 / 255.0).collect();
+    let product = |a: &[f64], b: &[f64]| -> Vec<f64> { a.iter().zip(b).map(|(a, b)| a * b).collect() };
+    let (mu1, mu2) = (blur(&x), blur(&y));
+    let (sq1, sq2, xy) = (blur(&product(&x, &x)), blur(&product(&y, &y)), blur(&product(&x, &y)));
+    let (c1, c2) = (0.01 * 0.01, 0.03 * 0.03);
+    let ssim = (0..width*height).map(|i| {
+        let (sigma1_sq, sigma2_sq, sigma12) = (sq1[i] - mu1[i] * mu1[i], sq2[i] - mu2[i] * mu2[i], xy[i] - mu1[i] * mu2[i]);
+        (2.0 * mu1[i] * mu2[i] + c1) * (2.0 * sigma12 + c2) / ((mu1[i] * mu1[i] + mu2[i] * mu2[i] + c1) * (sigma1_sq + sigma2_sq + c2))
+    }).sum::<f64>() / (width * height) as f64;
+    1.0 / ssim.min(1.0) - 1.0
+}
+
+#[test]
+fn fixed_point() {
+    let compare = |img1: &[u8], img2: &[u8], width: usize, color_type, fixed_point| -> f64 {
+        let mut d = new();
+        d.set_scales(&[1.0]);
+        d.set_fixed_point(fixed_point);
+        let i1 = d.create_image(img1, color_type, width, width, 0.45455).unwrap();
+        let i2 = d.create_image(img2, color_type, width, width, 0.45455).unwrap();
+        d.compare(&i1, i2).into()
+    };
+
+    // Nearly identical (bright and flat, shifted by one level), dark with sparse noise, and a smooth gradient with noise
+    let bright = vec![230u8; 16*16];
+    let dark: Vec<u8> = (0..TEST_WIDTH*TEST_HEIGHT).map(|i| (i % 20) as u8).collect();
+    let (smooth1, smooth2) = gradient_pair(1);
+    let cases = [
+        (bright.clone(), bright.iter().map(|&v| v + 1).collect(), 16),
+        (dark.clone(), dark.iter().enumerate().map(|(i, &v)| v + (i * 7919 % 5 == 0) as u8).collect(), TEST_WIDTH),
+        (smooth1, smooth2, TEST_WIDTH),
+    ];
+    for &(ref img1, ref img2, width) in &cases {
+        // The full-size scale is exact (the reference rounds its variances in double, by ~1e-13), whatever the float path's rounding does
+        let exact = exact_luma_dssim(img1, img2, width);
+        let fixed = compare(img1, img2, width, DSSIM_LUMA, true);
+        assert!(exact > 0.0);
+        assert!((exact - fixed).abs() < 1e-11, "{} vs {}", exact, fixed);
+        assert_eq!(0.0, compare(img1, img1, width, DSSIM_LUMA, true));
+
+        // GRAY is LUMA of its luma rounded to 8 bits
+        let rounded = |img: &[u8]| -> Vec<u8> { img.iter().map(|&v| (lab_exact([v, v, v])[0] * 255.0).round() as u8).collect() };
+        assert_eq!(compare(&rounded(img1), &rounded(img2), width, DSSIM_LUMA, true), compare(img1, img2, width, DSSIM_GRAY, true));
+    }
+}
+
+#[test]
+fn half_storage() {
+    let (img1, img2) = gradient_pair(3);
+    let compare = |original_half, modified_half, img2: &[u8]| {
+        let mut d = new();
+        d.set_half_storage(original_half);
+        let i1 = d.create_image(&img1, DSSIM_RGB, TEST_WIDTH, TEST_WIDTH*3, 0.45455).unwrap();
+        d.set_half_storage(modified_half);
+        let i2 = d.create_image(img2, DSSIM_RGB, TEST_WIDTH, TEST_WIDTH*3, 0.45455).unwrap();
+        let res: f64 = d.compare(&i1, i2).into();
+        res
+    };
+
+    let float = compare(false, false, &img2);
+    assert!(float > 0.0001);
+    for &(original_half, modified_half) in &[(true, true), (true, false), (false, true)] {
+        let half = compare(original_half, modified_half, &img2);
+        assert!(half != float);
+        assert!((float - half).abs() < (float * 0.04).max(3e-4), "{} vs {}", float, half);
+    }
+
+    // The covariance is computed from the difference of images, which is exactly 0
+    assert_eq!(0.0, compare(true, true, &img1));
+}
+
+/// The color table is ignored on CPUs where the C library converts to Lab with AVX2 and FMA
+#[cfg(test)]
+fn exact_lab_is_faster() -> bool {
+    #[cfg(target_arch = "x86_64")]
+    {
+        is_x86_feature_detected!("avx2") && is_x86_feature_detected!("fma")
+    }
+    #[cfg(not(target_arch = "x86_64"))]
+    {
+        false
+    }
+}
+
+#[test]
+fn color_lut() {
+    // Tiles of solid colors, with more of the dark ones, where the table is least accurate
+    let levels = [0u8, 4, 8, 16, 24, 32, 48, 64, 96, 128, 160, 192, 224, 255];
+    let n = levels.len();
+    let tile = 12;
+    let width = n * n * tile;
+    let height = n * tile;
+    let color = |x: usize, y: usize| [levels[x / tile / n], levels[x / tile % n], levels[y / tile]];
+    let rgb: Vec<u8> = (0..width*height).flat_map(|i| color(i % width, i / width).to_vec()).collect();
+
+    // Against black (all zeros) SSIM of a tile's center is c1/(v^2 + c1), which gives its value v in each channel
+    let black = vec![0u8; width*height*3];
+    let lab_of_tiles = |color_lut| -> Vec<[f64; 3]> {
+        let mut d = new();
+        d.set_color_lut(color_lut);
+        unsafe { ffi::dssim_set_color_handling(d.handle, 0, 0.95); }
+        d.set_save_ssim_maps(1, 3);
+        let img = d.create_image(&rgb, DSSIM_RGB, width, width*3, 0.45455).unwrap();
+        let zero = d.create_image(&black, DSSIM_LAB, width, width*3, 0.45455).unwrap();
+        d.compare(&img, zero);
+        let maps: Vec<SsimMap> = (0..3).map(|c| d.pop_ssim_map(0, c).unwrap()).collect();
+        let lab = (0..n*n*n).map(|t| {
+            let center = (t % (n*n)) * tile + tile/2 + ((t / (n*n)) * tile + tile/2) * width;
+            let mut v = [0.0; 3];
+            for c in 0..3 {
+                let ssim = unsafe { *maps[c].data.offset(center as isize) } as f64;
+                v[c] = (0.01 * 0.01 * (1.0 / ssim - 1.0)).sqrt();
+            }
+            v
+        }).collect();
+        for m in maps {
+            unsafe { libc::free(m.data as *mut libc::c_void); }
+        }
+        lab
+    };
+
+    let exact = lab_of_tiles(false);
+    let lut = lab_of_tiles(true);
+    let delta_e: Vec<f64> = exact.iter().zip(lut.iter()).map(|(e, l)| {
+        (0..3).map(|c| ((e[c] - l[c]) * [100.0, 220.0, 220.0][c]).powi(2)).sum::<f64>().sqrt()
+    }).collect();
+    // The top-right tile is yellow: the last red and green levels, and the first blue one
+    assert!((exact[n*n-1][0] - lab_exact([255, 255, 0])[0]).abs() < 1e-3);
+    let max = delta_e.iter().cloned().fold(0.0, f64::max);
+    let mean = delta_e.iter().sum::<f64>() / delta_e.len() as f64;
+    if exact_lab_is_faster() {
+        assert_eq!(max, 0.0);
+    } else {
+        assert!(max > 0.0 && max < 0.67, "max dE {}", max);
+        assert!(mean < 0.05, "mean dE {}", mean);
+    }
+
+    // Translucent pixels are composited before conversion, so they don't use the table
+    let (mut rgba1, mut rgba2) = gradient_pair(4);
+    for px in rgba1.chunks_mut(4).chain(rgba2.chunks_mut(4)) {
+        px[3] = 200;
+    }
+    let translucent = |color_lut| {
+        let mut d = new();
+        d.set_color_lut(color_lut);
+        compare_bitmaps(&mut d, &rgba1, &rgba2, DSSIM_RGBA, 4)
+    };
+    assert_eq!(translucent(false), translucent(true));
+}
+
+#[test]
+fn indexed() {
+    // The last 56 indices are past the palette, so they're black
+    let palette: Vec<dssim_rgba> = (0..200).map(|i| dssim_rgba {
+        r: (i * 7) as u8, g: (i * 13) as u8, b: (255 - i) as u8,
+        a: if i < 32 { (i * 8) as u8 } else { 255 },
+    }).collect();
+    let (img1, img2) = gradient_pair(1);
+    let expand = |img: &[u8]| -> Vec<dssim_rgba> {
+        img.iter().map(|&i| palette.get(i as usize).cloned().unwrap_or(dssim_rgba { r: 0, g: 0, b: 0, a: 255 })).collect()
+    };
+
+    let mut d = new();
+    let rgba = compare_bitmaps(&mut d, &expand(&img1), &expand(&img2), DSSIM_RGBA, 4);
+    let i1 = d.create_image_indexed(&img1, &palette, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    let i2 = d.create_image_indexed(&img2, &palette, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    let indexed: f64 = d.compare(&i1, i2).into();
+    assert!(rgba > 0.0001);
+    // The palette gets the same conversion and checkerboard as pixels
+    assert!((rgba - indexed).abs() < rgba * 1e-4, "{} vs {}", rgba, indexed);
+
+    let i1 = d.create_image_indexed(&img1, &palette, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    let i1b = d.create_image_indexed(&img1, &palette, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    assert_eq!(0.0, d.compare(&i1, i1b));
+}
+
+#[test]
+fn gray_rgb() {
+    let (gray1, gray2) = gradient_pair(1);
+    let rgb = |gray: &[u8]| -> Vec<u8> { gray.iter().flat_map(|&px| vec![px, px, px]).collect() };
+    let img1 = rgb(&gray1);
+    let mut tinted2 = rgb(&gray2);
+    for px in tinted2.chunks_mut(3).step_by(7) {
+        px[0] = px[0].saturating_add(20);
+    }
+
+    let mut d = new();
+    // img1 is stored as luma only, and compared as if it had the chroma of gray
+    let luma_only = compare_bitmaps(&mut d, &img1, &tinted2, DSSIM_RGB, 3);
+
+    // Same pixels with all three channels stored
+    let planes: Vec<Vec<f32>> = (0..3).map(|c| gray1.iter().map(|&px| lab_exact([px, px, px])[c] as f32).collect()).collect();
+    let full: f64 = {
+        let p: Vec<&[f32]> = planes.iter().map(|p| &p[..]).collect();
+        let i1 = d.create_image_float_planes(&p, TEST_WIDTH, TEST_WIDTH).unwrap();
+        let i2 = d.create_image(&tinted2, DSSIM_RGB, TEST_WIDTH, TEST_WIDTH*3, 0.45455).unwrap();
+        d.compare(&i1, i2).into()
+    };
+    assert!(full > 0.0001);
+    // Only rounding of the stored planes differs, while chroma of gray off by 0.2/220 would change it by 0.2%
+    assert!((luma_only - full).abs() < full * 1e-3, "{} vs {}", luma_only, full);
+    assert_eq!(0.0, compare_bitmaps(&mut d, &img1, &img1, DSSIM_RGB, 3));
+}
+
+#[test]
+fn gray_to_rgb() {
+    let (gray1, gray2) = gradient_pair(1);
+    let rgb1: Vec<u8> = gray1.iter().flat_map(|&px| vec![px, px, px]).collect();
+    let mut tinted2: Vec<u8> = gray2.iter().flat_map(|&px| vec![px, px, px]).collect();
+    tinted2[1] ^= 1;
+
+    let mut d = new();
+    let i1 = d.create_image(&gray1, DSSIM_GRAY_TO_RGB, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    let i2 = d.create_image(&tinted2, DSSIM_RGB, TEST_WIDTH, TEST_WIDTH*3, 0.45455).unwrap();
+    let gray: f64 = d.compare(&i1, i2).into();
+    let rgb = compare_bitmaps(&mut d, &rgb1, &tinted2, DSSIM_RGB, 3);
+    assert!(rgb > 0.0001);
+    // Gray RGB is stored as luma only too, with the same conversion
+    assert_eq!(gray, rgb);
+
+    // Unlike DSSIM_GRAY, chroma of the modified image counts
+    let i1 = d.create_image(&gray1, DSSIM_GRAY, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+    let i2 = d.create_image(&tinted2, DSSIM_RGB, TEST_WIDTH, TEST_WIDTH*3, 0.45455).unwrap();
+    let luma: f64 = d.compare(&i1, i2).into();
+    assert!(luma != gray);
+}
+
+#[test]
+fn ycbcr_gray() {
+    let neutral = vec![128u8; TEST_WIDTH*TEST_HEIGHT];
+    let strides = [TEST_WIDTH; 3];
+    // Limited range Y' of a neutral frame converted to 8-bit gray
+    let gray = |y: &[u8]| -> Vec<u8> { y.iter().map(|&v| ((v as f64 - 16.0) * 255.0 / 219.0).round() as u8).collect() };
+    let dssim_to_gray = |y: &[u8]| -> f64 {
+        let mut d = new();
+        let ycbcr = d.create_image_ycbcr([y, &neutral[..], &neutral[..]], strides, DSSIM_YCBCR444, 0, TEST_WIDTH, 0.45455).unwrap();
+        let gray = gray(y);
+        let rgb = d.create_image(&gray, DSSIM_GRAY_TO_RGB, TEST_WIDTH, TEST_WIDTH, 0.45455).unwrap();
+        d.compare(&rgb, ycbcr).into()
+    };
+
+    // 16, 89, 162 and 235 are exactly 0, 85, 170 and 255 in 8 bits
+    let exact: Vec<u8> = (0..TEST_WIDTH*TEST_HEIGHT).map(|i| [16u8, 89, 162, 235][((i % TEST_WIDTH) / 10 ^ (i / TEST_WIDTH) / 10) % 4]).collect();
+    assert_eq!(0.0, dssim_to_gray(&exact));
+
+    // Other levels differ only by rounding to 8 bits, while Cb off by one level would give 7e-5
+    let (luma, _) = gradient_pair(1);
+    let y: Vec<u8> = luma.iter().map(|&v| 16 + (v as u32 * 219 / 255) as u8).collect();
+    let rounded = dssim_to_gray(&y);
+    assert!(rounded > 0.0 && rounded < 3e-5, "{}", rounded);
+}
+
+#[test]
+fn ycbcr_420_odd() {
+    // Chroma of 4:2:0 rounds up, so its last column and row cover one pixel
+    let width = 75;
+    let height = 53;
+    let (chroma_width, chroma_height) = ((width + 1) / 2, (height + 1) / 2);
+    let chroma_stride = chroma_width + 3;
+    let y_plane: Vec<u8> = (0..width*height).map(|i| (16 + (i % width) * 2 + (i / width) + i * 7919 % 13) as u8).collect();
+    let cb: Vec<u8> = (0..chroma_stride*chroma_height).map(|i| (60 + (i % chroma_stride) * 3 + (i * 7919 % 11)) as u8).collect();
+    let cr: Vec<u8> = (0..chroma_stride*chroma_height).map(|i| (200 - (i / chroma_stride) * 3 - (i * 7919 % 7)) as u8).collect();
+    // Each chroma sample repeated for its 2x2 pixels
+    let full = |plane: &[u8]| -> Vec<u8> { (0..width*height).map(|i| plane[(i % width) / 2 + (i / width) / 2 * chroma_stride]).collect() };
+    let (cb444, cr444) = (full(&cb), full(&cr));
+
+    for &subsampling in &[1, 0] {
+        let mut d = new();
+        unsafe { ffi::dssim_set_color_handling(d.handle, subsampling, 0.95); }
+        let i420 = d.create_image_ycbcr([&y_plane[..], &cb[..], &cr[..]], [width, chroma_stride, chroma_stride], DSSIM_YCBCR420, 0, width, 0.45455).unwrap();
+        let i444 = d.create_image_ycbcr([&y_plane[..], &cb444[..], &cr444[..]], [width; 3], DSSIM_YCBCR444, 0, width, 0.45455).unwrap();
+        assert_eq!(0.0, d.compare(&i420, i444));
+
+        // Color of the bottom-right pixel only counts if chroma isn't subsampled again to width/2
+        let mut cb_corner = cb.clone();
+        cb_corner[chroma_width - 1 + (chroma_height - 1) * chroma_stride] ^= 64;
+        let corner = d.create_image_ycbcr([&y_plane[..], &cb_corner[..], &cr[..]], [width, chroma_stride, chroma_stride], DSSIM_YCBCR420, 0, width, 0.45455).unwrap();
+        let corner_diff: f64 = d.compare(&i420, corner).into();
+        assert_eq!(subsampling == 0, corner_diff > 0.0, "{}", corner_diff);
+    }
+}
+
+#[test]
+fn linear_rgba_f32() {
+    // Same colors as 8-bit RGBA with gamma 0.45455, in linear light with premultiplied alpha
+    let (rgba1, rgba2) = gradient_pair(4);
+    let linear = |rgba: &[u8]| -> Vec<[f32; 4]> {
+        rgba.chunks(4).map(|px| {
+            let a = px[3] as f64 / 255.0;
+            let c = |v: u8| ((v as f64 / 255.0).powf(1.0 / 0.45455) * a) as f32;
+            [c(px[0]), c(px[1]), c(px[2]), a as f32]
+        }).collect()
+    };
+    let (linear1, linear2) = (linear(&rgba1), linear(&rgba2));
+
+    let mut d = new();
+    let rgba = compare_bitmaps(&mut d, &rgba1, &rgba2, DSSIM_RGBA, 4);
+    let float = compare_bitmaps(&mut d, &linear1, &linear2, DSSIM_LINEAR_RGBA_F32, 16);
+    assert!(rgba > 0.0001);
+    // Opaque 8-bit pixels take a different path, which rounds differently
+    assert!((rgba - float).abs() < rgba * 1e-4, "{} vs {}", rgba, float);
+    let i1 = d.create_image(&rgba1, DSSIM_RGBA, TEST_WIDTH, TEST_WIDTH*4, 0.45455).unwrap();
+    let i2 = d.create_image(&linear1, DSSIM_LINEAR_RGBA_F32, TEST_WIDTH, TEST_WIDTH*16, 0.45455).unwrap();
+    assert_eq!(0.0, d.compare(&i1, i2));
+
+    // NaN is 0, so NaN alpha is transparent, whatever the color
+    let mut nan = linear1.clone();
+    let mut transparent = rgba1.clone();
+    for i in (0..nan.len()).step_by(5) {
+        nan[i] = [std::f32::NAN, 0.0, 0.0, std::f32::NAN];
+        transparent[i*4..i*4+4].copy_from_slice(&[0, 0, 0, 0]);
+    }
+    let i1 = d.create_image(&transparent, DSSIM_RGBA, TEST_WIDTH, TEST_WIDTH*4, 0.45455).unwrap();
+    let i2 = d.create_image(&nan, DSSIM_LINEAR_RGBA_F32, TEST_WIDTH, TEST_WIDTH*16, 0.45455).unwrap();
+    assert_eq!(0.0, d.compare(&i1, i2));
+}
+
+// Without OpenMP every number of threads runs the same single thread, so this checks nothing
+#[test]
+#[cfg_attr(not(feature = "openmp"), ignore)]
+fn threads() {
+    let (rgb1, rgb2) = gradient_pair(3);
+    let (luma1, luma2) = gradient_pair(1);
+    // Scores and the SSIM map of the first scale with each storage option (fixed point only applies to LUMA and GRAY)
+    let run = |num_threads| -> Vec<f64> {
+        let mut res = Vec::new();
+        for &(fixed_point, half_storage) in &[(false, false), (true, false), (false, true)] {
+            let mut d = new();
+            d.set_threads(num_threads);
+            d.set_fixed_point(fixed_point);
+            d.set_half_storage(half_storage);
+            d.set_save_ssim_maps(1, 1);
+            res.push(if fixed_point {
+                compare_bitmaps(&mut d, &luma1, &luma2, DSSIM_LUMA, 1)
+            } else {
+                compare_bitmaps(&mut d, &rgb1, &rgb2, DSSIM_RGB, 3)
+            });
+            let map = d.pop_ssim_map(0, 0).unwrap();
+            res.extend((0..map.width*map.height).map(|i| unsafe { *map.data.offset(i as isize) } as f64));
+            unsafe { libc::free(map.data as *mut libc::c_void); }
+        }
+        res
+    };
+
+    // 240 rows are enough for 8 bands of blurring
+    let single = run(1);
+    assert!(single[0] > 0.0001);
+    for &num_threads in &[2, 3, 8] {
+        assert!(single == run(num_threads), "{} threads", num_threads);
+    }
+}
+
+/// Planes and stride read by planes_row_callback()
+#[cfg(test)]
+struct CallbackPlanes<'a> {
+    planes: &'a [Vec<f32>],
+    stride: usize,
+}
+
+#[cfg(test)]
+extern "C" fn planes_row_callback(channels: *const *mut ffi::dssim_px_t, num_channels: c_int, y: c_int, width: c_int, user_data: *mut libc::c_void) {
+    let src = unsafe { &*(user_data as *const CallbackPlanes) };
+    let start = y as usize * src.stride;
+    for c in 0..num_channels as usize {
+        let row = unsafe { std::slice::from_raw_parts_mut(*channels.offset(c as isize), width as usize) };
+        row.copy_from_slice(&src.planes[c][start..start + width as usize]);
+    }
+}
+
+/// Image made by dssim_create_image_float_callback() from copies of rows of the planes
+#[cfg(test)]
+fn float_callback_image(d: &mut Dssim, planes: &[Vec<f32>], width: usize, stride: usize) -> DssimImage<'static> {
+    let mut src = CallbackPlanes { planes: planes, stride: stride };
+    let height = planes[0].len() / stride;
+    let handle = unsafe {
+        ffi::dssim_create_image_float_callback(d.handle, planes.len() as c_int, width as c_int, height as c_int, planes_row_callback, &mut src as *mut CallbackPlanes as *mut libc::c_void)
+    };
+    assert!(!handle.is_null());
+    DssimImage { handle: handle, _mem_marker: std::marker::PhantomData }
+}
+
+/// Rows of planes given to planes_rows_callback(), and the batches of (y, num_rows) it has been asked for
+#[cfg(test)]
+struct CallbackBatches<'a> {
+    src: CallbackPlanes<'a>,
+    batches: Vec<(c_int, c_int)>,
+}
+
+#[cfg(test)]
+extern "C" fn planes_rows_callback(channels: *const *mut ffi::dssim_px_t, num_channels: c_int, y: c_int, num_rows: c_int, width: c_int, stride: libc::size_t, user_data: *mut libc::c_void) {
+    let dst = unsafe { &mut *(user_data as *mut CallbackBatches) };
+    dst.batches.push((y, num_rows));
+    for i in 0..num_rows as usize {
+        let start = (y as usize + i) * dst.src.stride;
+        for c in 0..num_channels as usize {
+            let row = unsafe { std::slice::from_raw_parts_mut((*channels.offset(c as isize)).offset((i * stride as usize) as isize), width as usize) };
+            row.copy_from_slice(&dst.src.planes[c][start..start + width as usize]);
+        }
+    }
+}
+
+/// Gradient plane in 0-1 with `noise` levels of noise added
+#[cfg(test)]
+fn gradient_plane(stride: usize, height: usize, seed: usize, noise: usize) -> Vec<f32> {
+    (0..stride*height).map(|i| (((i % stride) * 3 + (i / stride) * seed + (i * 7919 % noise)) % 256) as f32 / 255.0).collect()
+}
+
+#[test]
+fn float_callback_rows() {
+    // Odd size, so that the last batch of rows is short and odd too
+    let width = 321;
+    let height = 241;
+    let planes1 = vec![gradient_plane(width, height, 5, 1), gradient_plane(width, height, 7, 1), gradient_plane(width, height, 11, 1)];
+    let planes2 = vec![gradient_plane(width, height, 5, 13), gradient_plane(width, height, 7, 5), gradient_plane(width, height, 11, 3)];
+
+    for &num_channels in &[1, 3] {
+        let mut d = new();
+        d.set_save_ssim_maps(1, num_channels as u8);
+        let mut rows_src = CallbackBatches { src: CallbackPlanes { planes: &planes1[..num_channels], stride: width }, batches: Vec::new() };
+        let handle = unsafe {
+            ffi::dssim_create_image_float_callback_rows(d.handle, num_channels as c_int, width as c_int, height as c_int, planes_rows_callback, &mut rows_src as *mut CallbackBatches as *mut libc::c_void)
+        };
+        assert!(!handle.is_null());
+        let rows1 = DssimImage { handle: handle, _mem_marker: std::marker::PhantomData };
+
+        let batches = &rows_src.batches;
+        let batch = batches[0].1;
+        let &(last_y, last_rows) = batches.last().unwrap();
+        assert!(batches.len() > 1 && batch % 2 == 0);
+        assert!(batches.iter().enumerate().all(|(i, &(y, rows))| y == i as c_int * batch && (rows == batch || y == last_y)));
+        assert!(last_rows < batch && last_rows % 2 == 1 && last_y + last_rows == height as c_int);
+
+        let per_row1 = float_callback_image(&mut d, &planes1[..num_channels], width, width);
+        let per_row1b = float_callback_image(&mut d, &planes1[..num_channels], width, width);
+        assert_eq!(0.0, d.compare(&rows1, per_row1b));
+
+        // Scores and SSIM maps against the same modified image
+        let mut compare = |original: &DssimImage| -> Vec<f64> {
+            let modified = float_callback_image(&mut d, &planes2[..num_channels], width, width);
+            let mut res = vec![d.compare(original, modified).into()];
+            for c in 0..num_channels {
+                let map = d.pop_ssim_map(0, c as u8).unwrap();
+                res.extend((0..map.width*map.height).map(|i| unsafe { *map.data.offset(i as isize) } as f64));
+                unsafe { libc::free(map.data as *mut libc::c_void); }
+            }
+            res
+        };
+        let rows = compare(&rows1);
+        assert!(rows[0] > 0.0001);
+        assert!(rows == compare(&per_row1));
+    }
+}
+
+#[test]
+fn float_planes() {
+    let width = 131;
+    let stride = 140;
+    let height = 97;
+    let plane = |seed: usize, noise: usize| gradient_plane(stride, height, seed, noise);
+    let planes1 = vec![plane(5, 1), plane(7, 1), plane(11, 1)];
+    let planes2 = vec![plane(5, 13), plane(7, 5), plane(11, 3)];
+    let bits = |planes: &[Vec<f32>]| -> Vec<u32> { planes.iter().flat_map(|p| p.iter().map(|v| v.to_bits())).collect() };
+    let (bits1, bits2) = (bits(&planes1), bits(&planes2));
+
+    for &(num_channels, half_storage) in &[(1, false), (3, false), (3, true)] {
+        let mut d = new();
+        d.set_half_storage(half_storage);
+        let borrowed: f64 = {
+            let p1: Vec<&[f32]> = planes1[..num_channels].iter().map(|p| &p[..]).collect();
+            let p2: Vec<&[f32]> = planes2[..num_channels].iter().map(|p| &p[..]).collect();
+            let i1 = d.create_image_float_planes(&p1, width, stride).unwrap();
+            let i2 = d.create_image_float_planes(&p2, width, stride).unwrap();
+            d.compare(&i1, i2).into()
+        };
+        let i1 = float_callback_image(&mut d, &planes1[..num_channels], width, stride);
+        let i2 = float_callback_image(&mut d, &planes2[..num_channels], width, stride);
+        let copied: f64 = d.compare(&i1, i2).into();
+
+        assert!(copied > 0.0001);
+        assert_eq!(copied, borrowed);
+        assert_eq!(bits1, bits(&planes1));
+        assert_eq!(bits2, bits(&planes2));
+    }
+}
@@ -0,0 +1,247 @@
+/*
+ * Checks of internal kernels of dssim.c, which is included to reach its static functions.
+ * Built and run by `make test`. Exits with 1 if any check fails.
+ */
+#include "dssim.c"
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(const bool ok, const char *what, const int width, const int height, const double value)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s (width %d, height %d): %g\n", what, width, height, value);
+        failures++;
+    }
+}
+
+/* Deterministic pseudo-random pixels in 0-1 */
+static void random_pixels(dssim_px_t *px, const int n, unsigned int seed)
+{
+    for(int i=0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        px[i] = (seed >> 8) / (float)(1 << 24);
+    }
+}
+
+/* Distance in representable floats between two non-negative floats */
+static uint32_t ulp_distance(const float a, const float b)
+{
+    const union { float f; uint32_t u; } ua = {a}, ub = {b};
+    return ua.u > ub.u ? ua.u - ub.u : ub.u - ua.u;
+}
+
+static uint32_t max_ulp_distance(const dssim_px_t *a, const dssim_px_t *b, const int n)
+{
+    uint32_t max = 0;
+    for(int i=0; i < n; i++) {
+        max = MAX(max, ulp_distance(a[i], b[i]));
+    }
+    return max;
+}
+
+#define MAX_TEST_WIDTH 67
+
+/*
+ * Each SIMD kernel the CPU has, against the scalar one, on widths that end in every remainder of the vector loops
+ */
+static void test_kernels(void)
+{
+#if DSSIM_X86_SIMD && !defined(USE_COCOA)
+    __builtin_cpu_init();
+    struct {
+        const char *name;
+        bool supported;
+        blur_row_fn *blur_row;
+        blur_rows3_fn *blur_rows3;
+        downsample_rows_fn *downsample_rows;
+    } kernels[] = {
+        {"sse4.1", __builtin_cpu_supports("sse4.1"), blur_row_sse41, blur_rows3_sse41, downsample_rows_sse41},
+        {"avx2", __builtin_cpu_supports("avx2"), blur_row_avx2, blur_rows3_avx2, downsample_rows_avx2},
+    };
+
+    dssim_px_t rows[3][2 * MAX_TEST_WIDTH], scalar[MAX_TEST_WIDTH], simd[MAX_TEST_WIDTH];
+    for(size_t k=0; k < sizeof(kernels)/sizeof(kernels[0]); k++) {
+        if (!kernels[k].supported) {
+            continue;
+        }
+        for(int width = 1; width <= MAX_TEST_WIDTH; width += width < 17 ? 1 : 25) {
+            for(int r=0; r < 3; r++) {
+                random_pixels(rows[r], 2 * width, width * 3 + r);
+            }
+
+            // Documented as up to 3 ulp per pixel
+            blur_row_scalar(rows[0], scalar, width);
+            kernels[k].blur_row(rows[0], simd, width);
+            check(max_ulp_distance(scalar, simd, width) <= 3, kernels[k].name, width, 1, max_ulp_distance(scalar, simd, width));
+
+            blur_rows3_scalar(rows[0], rows[1], rows[2], scalar, width);
+            kernels[k].blur_rows3(rows[0], rows[1], rows[2], simd, width);
+            check(max_ulp_distance(scalar, simd, width) <= 3, kernels[k].name, width, 3, max_ulp_distance(scalar, simd, width));
+
+            // Adds in the same order, but -ffast-math may regroup it differently, as documented
+            downsample_rows_scalar(rows[0], rows[1], scalar, width);
+            kernels[k].downsample_rows(rows[0], rows[1], simd, width);
+            check(max_ulp_distance(scalar, simd, width) <= 2, kernels[k].name, width, 2, max_ulp_distance(scalar, simd, width));
+        }
+    }
+#endif
+}
+
+/*
+ * Whole blurs with the kernels picked for this CPU, against the same blurs with scalar kernels forced,
+ * on the smallest sizes that are blurred and odd heights
+ */
+static void test_blur_dispatch(void)
+{
+    dssim_init_kernels();
+    blur_row_fn *const dispatched_row = blur_row;
+    blur_rows3_fn *const dispatched_rows3 = blur_rows3;
+
+    const int max_width = MAX_TEST_WIDTH, max_height = 33;
+    dssim_px_t *const img = malloc(max_width * max_height * sizeof(img[0]));
+    dssim_px_t *const scalar = malloc(max_width * max_height * sizeof(img[0]));
+    dssim_px_t *const simd = malloc(max_width * max_height * sizeof(img[0]));
+    dssim_px_t *const tmp = malloc(blur_band_tmp_size(max_width) * sizeof(tmp[0]));
+
+    for(int width = 5; width <= max_width; width += width < 17 ? 1 : 25) {
+        for(int height = 5; height <= max_height; height += height < 17 ? 2 : 16) {
+            random_pixels(img, width * height, width * 100 + height);
+
+            blur_row = blur_row_scalar;
+            blur_rows3 = blur_rows3_scalar;
+            box_blur_planes(1, 1, blur_input_plane, img, (dssim_px_t *[]){scalar}, tmp, width, height);
+
+            blur_row = dispatched_row;
+            blur_rows3 = dispatched_rows3;
+            box_blur_planes(1, 1, blur_input_plane, img, (dssim_px_t *[]){simd}, tmp, width, height);
+
+            // 4 passes of up to 3 ulp each, averaged with neighbours that also differ
+            const uint32_t ulps = max_ulp_distance(scalar, simd, width * height);
+            check(ulps <= 12, "blur", width, height, ulps);
+        }
+    }
+
+    free(img); free(scalar); free(simd); free(tmp);
+}
+
+/*
+ * lab_lut_lookup() against the exact conversion of every 8-bit color, with the error documented for dssim_set_color_lut()
+ */
+static void test_lab_lut(void)
+{
+    dssim_init_kernels();
+    const double gamma = dssim_srgb_gamma;
+    dssim_lab_lut *const lut = lab_lut_create(gamma);
+    dssim_px_t gamma_lut[256];
+    set_gamma(gamma_lut, gamma);
+
+    dssim_px_t r[256], g[256], l[256], A[256], B[256];
+    double max_error = 0, sum_error = 0;
+    for(int ri = 0; ri < 256; ri++) {
+        for(int gi = 0; gi < 256; gi++) {
+            for(int bi = 0; bi < 256; bi++) {
+                r[bi] = gamma_lut[ri];
+                g[bi] = gamma_lut[gi];
+            }
+            linear_to_lab(r, g, gamma_lut, l, A, B, 256);
+
+            for(int bi = 0; bi < 256; bi++) {
+                const dssim_lab px = lab_lut_lookup(lut, ri, gi, bi);
+                // Channels are scaled to 0-1, so they're scaled back to ΔE
+                const double dl = 100.0 * (px.l - l[bi]), dA = 220.0 * (px.A - A[bi]), dB = 220.0 * (px.b - B[bi]);
+                const double error = sqrt(dl * dl + dA * dA + dB * dB);
+                max_error = MAX(max_error, error);
+                sum_error += error;
+            }
+        }
+    }
+    free(lut);
+    check(max_error < 0.675, "lab_lut max ΔE", 256, 256 * 256, max_error);
+    check(sum_error / (1<<24) < 0.025, "lab_lut mean ΔE", 256, 256 * 256, sum_error / (1<<24));
+}
+
+#if DSSIM_X86_SIMD
+/*
+ * Largest relative error of cbrt_avx2() over the inputs it gets from linear_to_lab_avx2() must be below 1 ulp
+ */
+__attribute__((target("avx2,fma")))
+static void test_cbrt_avx2(void)
+{
+    const double lo = 216.0 / 24389.0, hi = 1.1;
+    double max_error = 0;
+    for(int i = 0; i < 1<<16; i += 8) {
+        float x[8], y[8];
+        for(int j = 0; j < 8; j++) {
+            x[j] = lo + (hi - lo) * (i + j) / (1<<16);
+        }
+        _mm256_storeu_ps(y, cbrt_avx2(_mm256_loadu_ps(x)));
+        for(int j = 0; j < 8; j++) {
+            max_error = MAX(max_error, fabs(y[j] - cbrt(x[j])) / cbrt(x[j]));
+        }
+    }
+    check(max_error < 1.0 / (1<<23), "cbrt_avx2", 1<<16, 1, max_error);
+}
+
+/* Grid points per axis of linear RGB checked by test_linear_to_lab_avx2() */
+#define LAB_CHECK_SIZE 64
+
+/*
+ * L, A and b from linear_to_lab_avx2() must be within 3e-7 of the same formula in double with exact cube roots,
+ * over a grid of linear RGB
+ */
+static void test_linear_to_lab_avx2(void)
+{
+    dssim_px_t r[LAB_CHECK_SIZE], g[LAB_CHECK_SIZE], b[LAB_CHECK_SIZE], l[LAB_CHECK_SIZE], A[LAB_CHECK_SIZE], B[LAB_CHECK_SIZE];
+    double max_error = 0;
+    for(int ri = 0; ri < LAB_CHECK_SIZE; ri++) {
+        for(int gi = 0; gi < LAB_CHECK_SIZE; gi++) {
+            for(int bi = 0; bi < LAB_CHECK_SIZE; bi++) {
+                r[bi] = ri / (double)(LAB_CHECK_SIZE-1);
+                g[bi] = gi / (double)(LAB_CHECK_SIZE-1);
+                b[bi] = bi / (double)(LAB_CHECK_SIZE-1);
+            }
+            linear_to_lab_avx2(r, g, b, l, A, B, LAB_CHECK_SIZE);
+
+            for(int i = 0; i < LAB_CHECK_SIZE; i++) {
+                const double f[3] = {
+                    (r[i] * 0.4124 + g[i] * 0.3576 + b[i] * 0.1805) / D65x,
+                    (r[i] * 0.2126 + g[i] * 0.7152 + b[i] * 0.0722) / D65y,
+                    (r[i] * 0.0193 + g[i] * 0.1192 + b[i] * 0.9505) / D65z,
+                };
+                double lab_f[3];
+                for(int c = 0; c < 3; c++) {
+                    lab_f[c] = f[c] > 216.0 / 24389.0 ? cbrt(f[c]) - 16.0/116.0 : (24389.0 / 27.0) / 116.0 * f[c];
+                }
+                const double exact_l = lab_f[1] * 1.16;
+                const double exact_A = 86.2/220.0 + 500.0/220.0 * (lab_f[0] - lab_f[1]);
+                const double exact_B = 107.9/220.0 + 200.0/220.0 * (lab_f[1] - lab_f[2]);
+                max_error = MAX(max_error, fabs(l[i] - exact_l));
+                max_error = MAX(max_error, fabs(A[i] - exact_A));
+                max_error = MAX(max_error, fabs(B[i] - exact_B));
+            }
+        }
+    }
+    check(max_error < 3e-7, "linear_to_lab_avx2", LAB_CHECK_SIZE, LAB_CHECK_SIZE * LAB_CHECK_SIZE, max_error);
+}
+#endif
+
+int main(void)
+{
+    test_kernels();
+    test_blur_dispatch();
+    test_lab_lut();
+#if DSSIM_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        test_cbrt_avx2();
+        test_linear_to_lab_avx2();
+    }
+#endif
+
+    if (failures) {
+        return 1;
+    }
+    puts("dssim_test: all checks passed");
+    return 0;
+}
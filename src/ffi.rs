@@ -2,7 +2,7 @@
 #![allow(non_camel_case_types)]
 
 extern crate libc;
-use ::libc::{c_int, c_uint, c_void};
+use ::libc::{c_int, c_uint, c_void, size_t};
 
 pub enum dssim_image { }
 pub enum dssim_attr { }
@@ -28,8 +28,17 @@ pub enum dssim_colortype {
     DSSIM_LUMA = 4,
     DSSIM_LAB = 5,
     DSSIM_RGBA_TO_GRAY = 35,
+    DSSIM_GRAY_TO_RGB = 65,
+    DSSIM_YCBCR420 = 6,
+    DSSIM_YCBCR444 = 7,
+    DSSIM_LINEAR_RGBA_F32 = 8,
+    DSSIM_LINEAR_RGBA_F16 = 9,
 }
 
+// Flags combined with DSSIM_YCBCR420 or DSSIM_YCBCR444 in dssim_create_image_ycbcr()
+pub const DSSIM_YCBCR_BT709: c_int = 128;
+pub const DSSIM_YCBCR_10BIT: c_int = 256;
+
 #[repr(C)]
 #[derive(Copy, Clone)]
 pub struct dssim_ssim_map {
@@ -42,10 +51,19 @@ pub struct dssim_ssim_map {
 pub type dssim_row_callback =
     extern "C" fn(channels: *const *mut dssim_px_t, num_channels: c_int,
                   y: c_int, width: c_int, user_data: *mut c_void) -> ();
+pub type dssim_rows_callback =
+    extern "C" fn(channels: *const *mut dssim_px_t, num_channels: c_int,
+                  y: c_int, num_rows: c_int, width: c_int, stride: size_t,
+                  user_data: *mut c_void) -> ();
 extern "C" {
     pub fn dssim_create_attr() -> *mut dssim_attr;
     pub fn dssim_dealloc_attr(arg1: *mut dssim_attr) -> ();
     pub fn dssim_set_scales(attr: *mut dssim_attr, num: c_int, weights: *const f64) -> ();
+    pub fn dssim_set_blur_sigma(attr: *mut dssim_attr, sigma: f64) -> ();
+    pub fn dssim_set_fixed_point(attr: *mut dssim_attr, enabled: c_int) -> ();
+    pub fn dssim_set_half_storage(attr: *mut dssim_attr, enabled: c_int) -> ();
+    pub fn dssim_set_color_lut(attr: *mut dssim_attr, enabled: c_int) -> ();
+    pub fn dssim_set_threads(attr: *mut dssim_attr, num_threads: c_int) -> ();
     pub fn dssim_set_save_ssim_maps(arg1: *mut dssim_attr,
                                     num_scales: c_uint,
                                     num_channels: c_uint) -> ();
@@ -61,6 +79,24 @@ extern "C" {
                               color_type: dssim_colortype,
                               width: c_int, height: c_int,
                               gamma: f64) -> *mut dssim_image;
+    pub fn dssim_create_image_ycbcr(arg1: *mut dssim_attr,
+                                    planes: *const *const c_void,
+                                    strides: *const size_t,
+                                    color_type: c_int,
+                                    width: c_int, height: c_int,
+                                    gamma: f64) -> *mut dssim_image;
+    pub fn dssim_create_image_strided(arg1: *mut dssim_attr,
+                                      base: *const u8,
+                                      stride: size_t,
+                                      color_type: dssim_colortype,
+                                      width: c_int, height: c_int,
+                                      gamma: f64) -> *mut dssim_image;
+    pub fn dssim_create_image_indexed(arg1: *mut dssim_attr,
+                                      row_pointers: *const *const u8,
+                                      palette: *const dssim_rgba,
+                                      num_palette: c_int,
+                                      width: c_int, height: c_int,
+                                      gamma: f64) -> *mut dssim_image;
     pub fn dssim_create_image_float_callback(arg1: *mut dssim_attr,
                                              num_channels: c_int,
                                              width: c_int,
@@ -68,6 +104,20 @@ extern "C" {
                                              cb: dssim_row_callback,
                                              callback_user_data: *mut c_void)
                                              -> *mut dssim_image;
+    pub fn dssim_create_image_float_callback_rows(arg1: *mut dssim_attr,
+                                                  num_channels: c_int,
+                                                  width: c_int,
+                                                  height: c_int,
+                                                  cb: dssim_rows_callback,
+                                                  callback_user_data: *mut c_void)
+                                                  -> *mut dssim_image;
+    pub fn dssim_create_image_float_planes(arg1: *mut dssim_attr,
+                                           num_channels: c_int,
+                                           planes: *const *const dssim_px_t,
+                                           stride: size_t,
+                                           width: c_int,
+                                           height: c_int)
+                                           -> *mut dssim_image;
     pub fn dssim_dealloc_image(arg1: *mut dssim_image) -> ();
     pub fn dssim_compare(arg1: *mut dssim_attr, original: *const dssim_image,
                          modified: *mut dssim_image) -> f64;
@@ -46,7 +46,7 @@ static int read_image(const char *filename, png24_image *image)
         }
     }
 
-    int retval = rwpng_read_image24(fp, image, 0);
+    int retval = rwpng_read_image24_native(fp, image, 0);
 
     if (!using_stdin) {
         fclose(fp);
@@ -118,6 +118,19 @@ double get_gamma(const png24_image *image) {
     return 0.45455;
 }
 
+/*
+ Palette images are kept indexed, so that their palette is converted instead of every pixel.
+ Opaque gray and RGB images are read in their own layout. Gray is compared like gray RGB, so scores don't depend on the layout.
+ */
+static dssim_image *create_image(dssim_attr *attr, const png24_image *image)
+{
+    if (image->num_palette) {
+        return dssim_create_image_indexed(attr, image->row_pointers, (const dssim_rgba *)image->palette, image->num_palette, image->width, image->height, get_gamma(image));
+    }
+    const dssim_colortype color_type = image->channels == 1 ? DSSIM_GRAY_TO_RGB : (image->channels == 3 ? DSSIM_RGB : DSSIM_RGBA);
+    return dssim_create_image(attr, image->row_pointers, color_type, image->width, image->height, get_gamma(image));
+}
+
 int main(int argc, char *const argv[])
 {
     char *map_output_file = NULL;
@@ -158,7 +171,7 @@ int main(int argc, char *const argv[])
 
     dssim_attr *attr = dssim_create_attr();
 
-    dssim_image *original = dssim_create_image(attr, image1.row_pointers, DSSIM_RGBA, image1.width, image1.height, get_gamma(&image1));
+    dssim_image *original = create_image(attr, &image1);
     free(image1.row_pointers);
     free(image1.rgba_data);
 
@@ -178,7 +191,7 @@ int main(int argc, char *const argv[])
             break;
         }
 
-        dssim_image *modified = dssim_create_image(attr, image2.row_pointers, DSSIM_RGBA, image2.width, image2.height, get_gamma(&image2));
+        dssim_image *modified = create_image(attr, &image2);
         free(image2.row_pointers);
         free(image2.rgba_data);
 
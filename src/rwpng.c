@@ -195,7 +195,7 @@ static void rwpng_warning_stderr_handler(png_structp png_ptr, png_const_charp ms
 static void rwpng_warning_silent_handler(png_structp png_ptr, png_const_charp msg) {
 }
 
-static pngquant_error rwpng_read_image24_libpng(FILE *infile, png24_image *mainprog_ptr, int verbose)
+static pngquant_error rwpng_read_image24_libpng(FILE *infile, png24_image *mainprog_ptr, int verbose, int keep_palette, int keep_color_type)
 {
     png_structp  png_ptr = NULL;
     png_infop    info_ptr = NULL;
@@ -250,7 +250,42 @@ static pngquant_error rwpng_read_image24_libpng(FILE *infile, png24_image *mainp
 
     /* GRR TO DO:  preserve all safe-to-copy ancillary PNG chunks */
 
-    if (!(color_type & PNG_COLOR_MASK_ALPHA)) {
+    /* palette images can be kept as 8-bit indices instead, with PLTE and tRNS
+     * as the palette, and opaque gray and RGB images as 1 or 3 bytes per pixel */
+
+    const int indexed = keep_palette && color_type == PNG_COLOR_TYPE_PALETTE;
+    const int opaque = !(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+    const int native_gray = keep_color_type && opaque && color_type == PNG_COLOR_TYPE_GRAY;
+    const int native_rgb = keep_color_type && opaque && color_type == PNG_COLOR_TYPE_RGB;
+    mainprog_ptr->channels = indexed || native_gray ? 1 : (native_rgb ? 3 : 4);
+
+    if (native_gray || native_rgb) {
+        if (bit_depth < 8) { /* only gray can have fewer than 8 bits */
+            png_set_expand_gray_1_2_4_to_8(png_ptr);
+        }
+    } else if (indexed) {
+        if (bit_depth < 8) {
+            png_set_packing(png_ptr);
+        }
+
+        png_colorp palette = NULL;
+        int num_palette = 0;
+        png_get_PLTE(png_ptr, info_ptr, &palette, &num_palette);
+
+        png_bytep trans_alpha = NULL;
+        int num_trans = 0;
+        if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+            png_get_tRNS(png_ptr, info_ptr, &trans_alpha, &num_trans, NULL);
+        }
+
+        for (int i = 0; i < num_palette; i++) {
+            mainprog_ptr->palette[i] = (rwpng_rgba){
+                palette[i].red, palette[i].green, palette[i].blue,
+                i < num_trans ? trans_alpha[i] : 255,
+            };
+        }
+        mainprog_ptr->num_palette = num_palette;
+    } else if (!(color_type & PNG_COLOR_MASK_ALPHA)) {
 #ifdef PNG_READ_FILLER_SUPPORTED
         png_set_expand(png_ptr);
         png_set_filler(png_ptr, 65535L, PNG_FILLER_AFTER);
@@ -266,7 +301,7 @@ static pngquant_error rwpng_read_image24_libpng(FILE *infile, png24_image *mainp
         png_set_strip_16(png_ptr);
     }
 
-    if (!(color_type & PNG_COLOR_MASK_COLOR)) {
+    if (!(color_type & PNG_COLOR_MASK_COLOR) && !native_gray) {
         png_set_gray_to_rgb(png_ptr);
     }
 
@@ -385,20 +420,26 @@ static pngquant_error rwpng_read_image24_libpng(FILE *infile, png24_image *mainp
     if (hInProfile != NULL) {
 
         cmsHPROFILE hOutProfile = cmsCreate_sRGBProfile();
-        cmsHTRANSFORM hTransform = cmsCreateTransform(hInProfile, TYPE_RGBA_8,
-                                                      hOutProfile, TYPE_RGBA_8,
+        /* gray images are never transformed */
+        const cmsUInt32Number pixel_type = native_rgb ? TYPE_RGB_8 : TYPE_RGBA_8;
+        cmsHTRANSFORM hTransform = cmsCreateTransform(hInProfile, pixel_type,
+                                                      hOutProfile, pixel_type,
                                                       INTENT_PERCEPTUAL,
                                                       omp_get_max_threads() > 1 ? cmsFLAGS_NOCACHE : 0);
 
-        #pragma omp parallel for \
-            if (mainprog_ptr->height*mainprog_ptr->width > 8000) \
-            schedule(static)
-        for (unsigned int i = 0; i < mainprog_ptr->height; i++) {
-            /* It is safe to use the same block for input and output,
-               when both are of the same TYPE. */
-            cmsDoTransform(hTransform, row_pointers[i],
-                                       row_pointers[i],
-                                       mainprog_ptr->width);
+        if (indexed) {
+            cmsDoTransform(hTransform, mainprog_ptr->palette, mainprog_ptr->palette, mainprog_ptr->num_palette);
+        } else {
+            #pragma omp parallel for \
+                if (mainprog_ptr->height*mainprog_ptr->width > 8000) \
+                schedule(static)
+            for (unsigned int i = 0; i < mainprog_ptr->height; i++) {
+                /* It is safe to use the same block for input and output,
+                   when both are of the same TYPE. */
+                cmsDoTransform(hTransform, row_pointers[i],
+                                           row_pointers[i],
+                                           mainprog_ptr->width);
+            }
         }
 
         cmsDeleteTransform(hTransform);
@@ -454,7 +495,21 @@ pngquant_error rwpng_read_image24(FILE *infile, png24_image *input_image_p, int
 #if USE_COCOA
     return rwpng_read_image24_cocoa(infile, input_image_p);
 #else
-    return rwpng_read_image24_libpng(infile, input_image_p, verbose);
+    return rwpng_read_image24_libpng(infile, input_image_p, verbose, 0, 0);
+#endif
+}
+
+/*
+ Same as rwpng_read_image24(), but palette images are read as 1-byte indices into input_image_p->palette,
+ and opaque gray and RGB images are kept in their own layout, with 1 or 3 bytes per pixel (see input_image_p->channels).
+ The Cocoa reader always returns RGBA.
+ */
+pngquant_error rwpng_read_image24_native(FILE *infile, png24_image *input_image_p, int verbose)
+{
+#if USE_COCOA
+    return rwpng_read_image24_cocoa(infile, input_image_p);
+#else
+    return rwpng_read_image24_libpng(infile, input_image_p, verbose, 1, 1);
 #endif
 }
 
@@ -90,10 +90,13 @@ typedef struct {
     size_t file_size;
     double gamma;
     unsigned char **row_pointers;
-    unsigned char *rgba_data;
+    unsigned char *rgba_data; // or 1-byte palette indices if num_palette > 0
     struct rwpng_chunk *chunks;
     rwpng_color_transform input_color;
     rwpng_color_transform output_color;
+    unsigned int num_palette; // only set by rwpng_read_image24_native()
+    unsigned int channels; // bytes per pixel of rgba_data: 4, or 1 and 3 from rwpng_read_image24_native()
+    rwpng_rgba palette[256];
 } png24_image;
 
 typedef struct {
@@ -122,6 +125,7 @@ typedef union {
 void rwpng_version_info(FILE *fp);
 
 pngquant_error rwpng_read_image24(FILE *infile, png24_image *mainprog_ptr, int verbose);
+pngquant_error rwpng_read_image24_native(FILE *infile, png24_image *mainprog_ptr, int verbose);
 pngquant_error rwpng_write_image8(FILE *outfile, const png8_image *mainprog_ptr);
 pngquant_error rwpng_write_image24(FILE *outfile, const png24_image *mainprog_ptr);
 void rwpng_free_image24(png24_image *);
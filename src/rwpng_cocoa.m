@@ -64,6 +64,7 @@ int rwpng_read_image24_cocoa(FILE *fp, png24_image *out)
     out->width = width;
     out->height = height;
     out->rgba_data = (unsigned char *)pixel_data;
+    out->channels = 4;
     out->row_pointers = malloc(sizeof(out->row_pointers[0])*out->height);
     for(int i=0; i < out->height; i++) {
         out->row_pointers[i] = (unsigned char *)&pixel_data[width*i];